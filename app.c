@@ -40,9 +40,9 @@ void setarray(int r[], int m, ...)
 void *threadfunc1(void *a)
 {
     int tid;
-    int request1[MAXR];
-    int request2[MAXR];
-    int claim[MAXR];
+    int request1[NUMR];
+    int request2[NUMR];
+    int claim[NUMR];
 
     tid = *((int *)a);
     reman_connect(tid);
@@ -66,9 +66,9 @@ void *threadfunc1(void *a)
 void *threadfunc2(void *a)
 {
     int tid;
-    int request1[MAXR];
-    int request2[MAXR];
-    int claim[MAXR];
+    int request1[NUMR];
+    int request2[NUMR];
+    int claim[NUMR];
     tid = *((int *)a);
     reman_connect(tid);
     setarray(claim, NUMR, 1, 1);
@@ -0,0 +1,334 @@
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "reman.h"
+#include "reman_vec.h" // For the kernel ISA in the header line
+
+// Kernels compiled for the default geometry and for 16 threads x 32
+// resources, used with -f
+#define REMAN_FIXED_T 8
+#define REMAN_FIXED_R 64
+#define REMAN_FIXED_NAME fixed_8x64
+#include "reman_fixed.h"
+#define REMAN_FIXED_T 16
+#define REMAN_FIXED_R 32
+#define REMAN_FIXED_NAME fixed_16x32
+#include "reman_fixed.h"
+
+// Synthetic workload driver. Every thread claims a random subset of the
+// resources, then repeatedly requests a random set of its claimed
+// resources, holds it and releases it. Runs are reproducible for a given
+// seed (up to scheduling). See usage() for the parameters.
+
+int T = 8;             // Threads
+int R = 64;            // Resource types
+double density = 0.25; // Probability that a thread claims a resource
+int size_min = 1;      // Resource types per request, uniform in [size_min, size_max]
+int size_max = 4;
+int units = 1;         // Instances per resource type
+int hold_us = 0;       // Time a request is held before it is released
+int avoid = REMAN_AVOID; // Or REMAN_DETECT, REMAN_ORDERED
+int iters = 10000;     // Requests per thread
+int incremental = 0;   // Request the set one resource at a time
+int ascending = 0;     // ... in increasing resource index, as ordered mode requires
+int groups = 1;
+int period_ms = 10;    // Detector period in detect mode
+int wakeup_policy = REMAN_GRANT_FIFO;
+int fixed = 0;         // Use the fixed-geometry kernels when T and R match
+int flat_combining = 0; // Flat combining for locked requests and releases
+unsigned seed = 1;
+
+struct worker
+{
+    int tid;
+    uint64_t *lat;     // Latency of each reman_request in ns
+    int nlat;
+    int preempted;
+};
+
+uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Time one reman_request call
+int timed_request(struct worker *w, int request[])
+{
+    uint64_t t0 = now_ns();
+    int ret = reman_request(request);
+    w->lat[w->nlat++] = now_ns() - t0;
+    return ret;
+}
+
+int cmp_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+void *worker(void *a)
+{
+    struct worker *w = a;
+    unsigned rs = seed * 7919u + (unsigned)w->tid;
+    int *claim = calloc(R, sizeof(int));
+    int *request = calloc(R, sizeof(int));
+    int *held = calloc(R, sizeof(int));
+    int *pool = malloc(R * sizeof(int));
+    int npool = 0;
+
+    reman_connect(w->tid);
+    reman_set_priority(w->tid % 4); // Spread for the priority grant policy
+    for (int i = 0; i < R; i++)
+    {
+        if ((double)rand_r(&rs) / RAND_MAX < density)
+        {
+            claim[i] = units;
+            pool[npool++] = i;
+        }
+    }
+    if (npool == 0)
+    {
+        int i = rand_r(&rs) % R;
+        claim[i] = units;
+        pool[npool++] = i;
+    }
+    reman_claim(claim);
+
+    for (int it = 0; it < iters; it++)
+    {
+        // Pick k distinct claimed resources by a partial shuffle of the pool
+        int k = size_min + rand_r(&rs) % (size_max - size_min + 1);
+        if (k > npool)
+            k = npool;
+        for (int j = 0; j < k; j++)
+        {
+            int m = j + rand_r(&rs) % (npool - j);
+            int tmp = pool[j];
+            pool[j] = pool[m];
+            pool[m] = tmp;
+        }
+        if (ascending)
+            qsort(pool, k, sizeof(int), cmp_int);
+
+        memset(held, 0, R * sizeof(int));
+        if (incremental)
+        {
+            for (int j = 0; j < k; j++)
+            {
+                memset(request, 0, R * sizeof(int));
+                request[pool[j]] = 1 + rand_r(&rs) % units;
+                int ret = timed_request(w, request);
+                if (ret == REMAN_PREEMPTED)
+                {
+                    // Everything held so far was taken back
+                    memset(held, 0, R * sizeof(int));
+                    w->preempted++;
+                    break;
+                }
+                if (ret == 0)
+                    held[pool[j]] = request[pool[j]];
+            }
+        }
+        else
+        {
+            memset(request, 0, R * sizeof(int));
+            for (int j = 0; j < k; j++)
+                request[pool[j]] = 1 + rand_r(&rs) % units;
+            int ret = timed_request(w, request);
+            if (ret == 0)
+                memcpy(held, request, R * sizeof(int));
+            else if (ret == REMAN_PREEMPTED)
+                w->preempted++;
+        }
+
+        if (hold_us > 0)
+            usleep(hold_us);
+        reman_release(held);
+    }
+
+    reman_disconnect();
+    free(claim);
+    free(request);
+    free(held);
+    free(pool);
+    return NULL;
+}
+
+int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+uint64_t percentile(uint64_t sorted[], int n, double p)
+{
+    if (n == 0)
+        return 0;
+    int i = (int)(p * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+void usage(char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-t threads] [-r resources] [-d claim density 0..1]\n"
+            "          [-s min:max request size] [-u instances per resource]\n"
+            "          [-h hold us] [-m avoid|detect|ordered] [-n requests per thread]\n"
+            "          [-i] [-a] [-g groups] [-p detector period ms]\n"
+            "          [-w fifo|priority|shortest] [-S seed] [-f] [-c]\n"
+            "  -i requests each resource separately (can deadlock in detect mode)\n"
+            "  -a makes -i go in increasing resource order, as -m ordered always does\n"
+            "  -f uses the kernels compiled for -t 8 -r 64 or -t 16 -r 32 (with -u above 1)\n"
+            "  -c turns on flat combining\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "t:r:d:s:u:h:m:n:iag:p:w:S:fc")) != -1)
+    {
+        switch (opt)
+        {
+        case 't': T = atoi(optarg); break;
+        case 'r': R = atoi(optarg); break;
+        case 'd': density = atof(optarg); break;
+        case 's':
+            if (sscanf(optarg, "%d:%d", &size_min, &size_max) != 2)
+                size_max = size_min;
+            break;
+        case 'u': units = atoi(optarg); break;
+        case 'h': hold_us = atoi(optarg); break;
+        case 'm':
+            avoid = strcmp(optarg, "detect") == 0    ? REMAN_DETECT
+                    : strcmp(optarg, "ordered") == 0 ? REMAN_ORDERED
+                                                     : REMAN_AVOID;
+            break;
+        case 'n': iters = atoi(optarg); break;
+        case 'i': incremental = 1; break;
+        case 'a': ascending = 1; break;
+        case 'g': groups = atoi(optarg); break;
+        case 'p': period_ms = atoi(optarg); break;
+        case 'w':
+            wakeup_policy = strcmp(optarg, "priority") == 0   ? REMAN_GRANT_PRIORITY
+                           : strcmp(optarg, "shortest") == 0 ? REMAN_GRANT_SHORTEST
+                                                             : REMAN_GRANT_FIFO;
+            break;
+        case 'S': seed = (unsigned)atoi(optarg); break;
+        case 'f': fixed = 1; break;
+        case 'c': flat_combining = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (T <= 0 || R <= 0 || units <= 0 || iters <= 0 || groups <= 0 || groups > R ||
+        size_min <= 0 || size_max < size_min || period_ms < 0)
+        usage(argv[0]);
+    if (avoid == REMAN_ORDERED)
+        ascending = 1; // Anything else would be denied
+
+    if (groups > 1)
+    {
+        int *sizes = malloc(groups * sizeof(int));
+        for (int g = 0; g < groups; g++)
+            sizes[g] = R / groups + (g < R % groups);
+        reman_set_groups(groups, sizes);
+        free(sizes);
+    }
+    reman_set_stats(1);
+    reman_set_detect_period(period_ms);
+    reman_set_grant_policy(wakeup_policy);
+    reman_set_combining(flat_combining);
+    if (fixed)
+    {
+        const struct reman_fixed *k = T == 16 && R == 32 ? &fixed_16x32 : &fixed_8x64;
+        reman_set_fixed(k); // Ignored by reman_init unless T and R match
+        // With one unit per resource the scans use the bitmaps instead
+        fixed = k->t_count == T && k->r_count == R && units > 1;
+    }
+    if (reman_init(T, R, avoid) != 0)
+    {
+        fprintf(stderr, "reman_init failed\n");
+        return 1;
+    }
+    if (units > 1)
+    {
+        int *cap = malloc(R * sizeof(int));
+        for (int i = 0; i < R; i++)
+            cap[i] = units;
+        reman_set_capacity(cap);
+        free(cap);
+    }
+
+    int per_thread = incremental ? iters * size_max : iters;
+    struct worker *w = calloc(T, sizeof(struct worker));
+    pthread_t *th = malloc(T * sizeof(pthread_t));
+    uint64_t start = now_ns();
+    for (int i = 0; i < T; i++)
+    {
+        w[i].tid = i;
+        w[i].lat = malloc(per_thread * sizeof(uint64_t));
+        pthread_create(&th[i], NULL, worker, &w[i]);
+    }
+    for (int i = 0; i < T; i++)
+        pthread_join(th[i], NULL);
+    double secs = (now_ns() - start) / 1e9;
+
+    // Merge the latency samples
+    int n = 0, preempted = 0;
+    for (int i = 0; i < T; i++)
+    {
+        n += w[i].nlat;
+        preempted += w[i].preempted;
+    }
+    uint64_t *lat = malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+    n = 0;
+    for (int i = 0; i < T; i++)
+    {
+        memcpy(lat + n, w[i].lat, w[i].nlat * sizeof(uint64_t));
+        n += w[i].nlat;
+        free(w[i].lat);
+    }
+    qsort(lat, n, sizeof(uint64_t), cmp_u64);
+
+    struct reman_stats st;
+    reman_stats(&st);
+    uint64_t ops = st.requests + st.releases;
+
+    const char *policies[] = {"fifo", "priority", "shortest"};
+    const char *modes[] = {"detect", "avoid", "ordered"};
+    printf("mode=%s T=%d R=%d density=%.2f size=%d:%d units=%d hold_us=%d n=%d%s%s groups=%d grant=%s seed=%u isa=%s%s%s\n",
+           modes[avoid], T, R, density, size_min, size_max, units, hold_us, iters,
+           incremental ? " incremental" : "", incremental && ascending ? " ascending" : "", groups,
+           policies[wakeup_policy], seed, reman_vec_isa(),
+           fixed ? " fixed" : "", flat_combining ? " combining" : "");
+    printf("time         %.3f s\n", secs);
+    printf("throughput   %.0f ops/s (%lu requests, %lu releases)\n",
+           ops / secs, (unsigned long)st.requests, (unsigned long)st.releases);
+    printf("latency ns   p50=%lu p99=%lu p999=%lu max=%lu\n",
+           (unsigned long)percentile(lat, n, 0.50), (unsigned long)percentile(lat, n, 0.99),
+           (unsigned long)percentile(lat, n, 0.999), (unsigned long)(n > 0 ? lat[n - 1] : 0));
+    printf("outcomes     grants=%lu blocks=%lu denies=%lu preempted=%d fast_path=%lu combined=%lu\n",
+           (unsigned long)st.grants, (unsigned long)st.blocks, (unsigned long)st.denies,
+           preempted, (unsigned long)st.fast_path, (unsigned long)st.combined);
+    printf("detection    passes=%lu avg_ns=%.0f\n", (unsigned long)st.detections,
+           st.detections ? (double)st.detect_ns / st.detections : 0.0);
+    printf("safety       checks=%lu avg_ns=%.0f of_lock_hold=%.1f%%\n",
+           (unsigned long)st.safety_checks,
+           st.safety_checks ? (double)st.safety_ns / st.safety_checks : 0.0,
+           st.lock_hold_ns ? 100.0 * st.safety_ns / st.lock_hold_ns : 0.0);
+    printf("locks        acquires=%lu wait_ns=%lu hold_ns=%lu\n",
+           (unsigned long)st.lock_acquires, (unsigned long)st.lock_wait_ns,
+           (unsigned long)st.lock_hold_ns);
+
+    free(lat);
+    free(w);
+    free(th);
+    reman_destroy();
+    return 0;
+}
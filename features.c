@@ -0,0 +1,637 @@
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "reman.h"
+
+// Driver for the calls beyond request and release, one section per
+// feature. Every step is checked and reported; the exit status is the
+// number of failed checks.
+
+#define SHM_NAME "/reman_features"
+#define SNAPSHOT_PATH "/tmp/reman_features.snap"
+
+int failures = 0;
+
+void check(const char *what, int ok)
+{
+    printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok)
+        failures++;
+}
+
+double elapsed_ms(struct timespec start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+// Thread 1 of timed_requests(): holds the only instance for a while
+void *holder_thread(void *a)
+{
+    int *hold_ms = a;
+    int one[1] = {1};
+
+    reman_connect(1);
+    reman_claim(one);
+    reman_request(one);
+    usleep(*hold_ms * 1000);
+    reman_release(one);
+    reman_disconnect();
+    return NULL;
+}
+
+void timed_requests()
+{
+    int one[1] = {1};
+    int hold_ms = 300;
+    pthread_t th;
+    struct timespec start;
+
+    printf("tryrequest and request_timed\n");
+    reman_init(2, 1, REMAN_AVOID);
+    reman_connect(0);
+    reman_claim(one);
+    pthread_create(&th, NULL, holder_thread, &hold_ms);
+    usleep(100000); // Thread 1 holds R0
+
+    check("tryrequest of a held resource times out", reman_tryrequest(one) == REMAN_TIMEDOUT);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ret = reman_request_timed(one, 50);
+    double ms = elapsed_ms(start);
+    check("request_timed(50) times out", ret == REMAN_TIMEDOUT);
+    check("... after waiting at least 50 ms", ms >= 50);
+    check("request_timed(-1) is rejected", reman_request_timed(one, -1) == -1);
+    check("request_timed(2000) is granted on release", reman_request_timed(one, 2000) == 0);
+    check("release after the timed grant", reman_release(one) == 0);
+    check("nothing is left held after the withdrawals", reman_release(one) == -1);
+
+    pthread_join(th, NULL);
+    reman_disconnect();
+    reman_destroy();
+}
+
+void batches()
+{
+    int claim[3] = {2, 2, 2}, cap[3] = {2, 2, 2};
+    int r0[3] = {1, 0, 0}, r1[3] = {0, 2, 0}, r2[3] = {0, 0, 1}, held[3] = {0, 2, 1};
+    int two_r0[3] = {2, 0, 0};
+
+    printf("batch\n");
+    reman_init(1, 3, REMAN_AVOID);
+    reman_set_capacity(cap);
+    reman_connect(0);
+    reman_claim(claim);
+    reman_request(r0);
+
+    struct reman_op swap[3] = {{REMAN_OP_RELEASE, r0}, {REMAN_OP_REQUEST, r1}, {REMAN_OP_REQUEST, r2}};
+    check("release R0, request 2 R1 and 1 R2", reman_batch(swap, 3) == 0);
+    check("... R0 was released", reman_release(r0) == -1);
+
+    struct reman_op over[2] = {{REMAN_OP_REQUEST, two_r0}, {REMAN_OP_REQUEST, r0}};
+    check("batch over the claim is denied", reman_batch(over, 2) == -1);
+    check("... and applies nothing", reman_release(r0) == -1);
+
+    struct reman_op bad[1] = {{REMAN_OP_RELEASE, two_r0}};
+    check("batch releasing more than held is denied", reman_batch(bad, 1) == -1);
+
+    struct reman_op net_zero[2] = {{REMAN_OP_RELEASE, r2}, {REMAN_OP_REQUEST, r2}};
+    check("release and re-request of R2 nets out", reman_batch(net_zero, 2) == 0);
+    check("... and R1, R2 are still held", reman_release(held) == 0);
+
+    reman_disconnect();
+    reman_destroy();
+}
+
+// Child process of shared_mode(): takes R0 and waits to be killed
+int shared_child()
+{
+    int one[1] = {1};
+
+    if (reman_attach(SHM_NAME) != 0)
+        return 1;
+    reman_connect(1);
+    reman_claim(one);
+    if (reman_request(one) != 0)
+        return 1;
+    pause();
+    return 0;
+}
+
+void shared_mode()
+{
+    int one[1] = {1};
+
+    printf("shared mode\n");
+    check("attach to a segment that does not exist fails", reman_attach("/reman_features_none") == -1);
+    shm_unlink(SHM_NAME); // Left over from a run that was killed
+    reman_set_shared(SHM_NAME);
+    if (reman_init(2, 1, REMAN_DETECT) != 0)
+    {
+        check("create the shared segment", 0);
+        reman_set_shared(NULL);
+        return;
+    }
+    reman_set_shared(NULL); // For the managers that follow
+    check("attach while a manager exists fails", reman_attach(SHM_NAME) == -1);
+    reman_connect(0);
+    reman_claim(one);
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        execl("/proc/self/exe", "features", "child", (char *)NULL);
+        _exit(99);
+    }
+
+    // Wait until the child holds R0
+    int held = 0;
+    for (int i = 0; i < 200 && !held; i++)
+    {
+        if (reman_tryrequest(one) == 0)
+        {
+            reman_release(one);
+            usleep(10000);
+        }
+        else
+        {
+            held = 1;
+        }
+    }
+    check("child process holds R0", held);
+
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+    check("R0 is reclaimed from the killed process", reman_request_timed(one, 1000) == 0);
+    reman_release(one);
+
+    reman_disconnect();
+    reman_destroy();
+    check("segment is gone after reman_destroy", reman_attach(SHM_NAME) == -1);
+}
+
+void snapshots()
+{
+    int claim[2] = {1, 1}, r0[2] = {1, 0}, r1[2] = {0, 1};
+
+    printf("snapshot and restore\n");
+    reman_init(2, 2, REMAN_DETECT);
+    reman_connect(0);
+    reman_claim(claim);
+    reman_request(r0);
+    check("snapshot with thread 0 holding R0", reman_snapshot(SNAPSHOT_PATH) == 0);
+    reman_release(r0);
+    reman_disconnect();
+    reman_destroy();
+
+    reman_init(2, 2, REMAN_DETECT);
+    check("restore it", reman_restore(SNAPSHOT_PATH) == 0);
+    reman_connect(0);
+    check("... thread 0 holds R0 again", reman_release(r0) == 0);
+    check("... and nothing else", reman_release(r1) == -1);
+    reman_disconnect();
+    reman_destroy();
+
+    reman_init(3, 2, REMAN_DETECT);
+    check("restore into another geometry fails", reman_restore(SNAPSHOT_PATH) == -1);
+    check("restore of a missing file fails", reman_restore("/tmp/reman_features.none") == -1);
+    reman_destroy();
+
+    // Deadlock on the replay: thread 0 holds R0 and waits for R1, thread 1
+    // the other way round. Written in the snapshot layout: a header, then
+    // capacity, available, allocated, requested and max_claim.
+    struct
+    {
+        uint64_t magic;
+        int32_t t_count, r_count;
+        int cap[2], avail[2], alloc[2][2], req[2][2], claim[2][2];
+    } snap;
+    FILE *f = fopen(SNAPSHOT_PATH, "rb");
+    int got = f != NULL && fread(&snap, sizeof(snap), 1, f) == 1;
+    if (f != NULL)
+        fclose(f);
+    reman_init(2, 2, REMAN_DETECT);
+    if (got && reman_restore(SNAPSHOT_PATH) == 0)
+    {
+        int deadlocked[2][2][2] = {{{1, 0}, {0, 1}}, {{0, 1}, {1, 0}}};
+        memset(snap.avail, 0, sizeof(snap.avail));
+        memcpy(snap.alloc, deadlocked[0], sizeof(snap.alloc));
+        memcpy(snap.req, deadlocked[1], sizeof(snap.req));
+        for (int t = 0; t < 2; t++)
+            memcpy(snap.claim[t], claim, sizeof(claim));
+        f = fopen(SNAPSHOT_PATH, "wb");
+        fwrite(&snap, sizeof(snap), 1, f);
+        fclose(f);
+    }
+    reman_destroy();
+    reman_init(2, 2, REMAN_DETECT);
+    check("restore a deadlocked state", reman_restore(SNAPSHOT_PATH) == 0);
+    check("... reman_detect finds both threads", reman_detect() == 2);
+    check("... and nothing after recovery", reman_detect() == 0);
+    reman_destroy();
+
+    // A pending request beyond the claim cannot come from a live manager
+    snap.req[0][1] = 2;
+    f = fopen(SNAPSHOT_PATH, "wb");
+    fwrite(&snap, sizeof(snap), 1, f);
+    fclose(f);
+    reman_init(2, 2, REMAN_DETECT);
+    check("restore of a request over the claim fails", reman_restore(SNAPSHOT_PATH) == -1);
+    reman_destroy();
+
+    int none[2] = {1, 0};
+    reman_init(2, 2, REMAN_DETECT);
+    reman_set_capacity(none);
+    reman_snapshot(SNAPSHOT_PATH);
+    reman_destroy();
+    reman_init(2, 2, REMAN_DETECT);
+    check("restore a resource with no instances", reman_restore(SNAPSHOT_PATH) == 0);
+    reman_destroy();
+    unlink(SNAPSHOT_PATH);
+}
+
+// Victims of one deadlock: thread 1 holds R1 and waits for R0 and R2, held
+// by threads 0 and 2, which both wait for R1. R3 has two units, held by
+// threads 0 and 1, so detection reduces rows rather than following the
+// wait-for graph. Threads block in the order 0, 2, 1; the last one closes
+// the deadlock and its own detection pass recovers from it.
+pthread_barrier_t victim_barrier;
+int victim_units; // Of R3; with 1, R3 goes unused and the graph is followed
+int victim_results[3];
+
+void *victim_thread(void *a)
+{
+    int t = (int)(long)a;
+    int claim[4] = {1, 1, 1, 1};
+    int held[3][4] = {{1, 0, 0, 1}, {0, 1, 0, 1}, {0, 0, 1, 0}};
+    int wanted[3][4] = {{0, 1, 0, 0}, {1, 0, 1, 0}, {0, 1, 0, 0}};
+    int prio[3] = {2, 0, 1};
+    int turn[3] = {1, 3, 2};
+
+    if (victim_units < 2)
+        held[t][3] = 0;
+    reman_connect(t);
+    reman_set_priority(prio[t]);
+    reman_claim(claim);
+    reman_request(held[t]);
+    pthread_barrier_wait(&victim_barrier);
+    usleep(turn[t] * 50000);
+    victim_results[t] = reman_request_timed(wanted[t], 2000); // Times out rather than hangs
+    if (victim_results[t] == 0)
+    {
+        for (int i = 0; i < 4; i++)
+            held[t][i] += wanted[t][i];
+        reman_release(held[t]);
+    }
+    reman_disconnect();
+    return NULL;
+}
+
+// Run the deadlock under policy, with units of R3; fills victim_results
+void run_victims(int policy, int units)
+{
+    pthread_t th[3];
+    int cap[4] = {1, 1, 1, units};
+
+    victim_units = units;
+    reman_set_victim_policy(policy);
+    reman_init(3, 4, REMAN_DETECT);
+    reman_set_capacity(cap);
+    pthread_barrier_init(&victim_barrier, NULL, 3);
+    for (long t = 0; t < 3; t++)
+    {
+        pthread_create(&th[t], NULL, victim_thread, (void *)t);
+        usleep(20000); // Connect in tid order, for YOUNGEST
+    }
+    for (int t = 0; t < 3; t++)
+        pthread_join(th[t], NULL);
+    pthread_barrier_destroy(&victim_barrier);
+    reman_destroy();
+    reman_set_victim_policy(REMAN_VICTIM_FIRST);
+}
+
+void victims()
+{
+    struct
+    {
+        int policy;
+        const char *what;
+        int preempted[3];
+    } cases[] = {
+        {REMAN_VICTIM_FIRST, "FIRST preempts threads 0, then 1", {1, 1, 0}},
+        {REMAN_VICTIM_FEWEST, "FEWEST preempts threads 2, then 0", {1, 0, 1}},
+        {REMAN_VICTIM_PRIORITY, "PRIORITY preempts thread 1 only", {0, 1, 0}},
+        {REMAN_VICTIM_YOUNGEST, "YOUNGEST preempts threads 2, then 1", {0, 1, 1}},
+        {REMAN_VICTIM_MIN, "MIN preempts thread 1 only", {0, 1, 0}},
+    };
+
+    printf("deadlock victims\n");
+    for (int c = 0; c < 5; c++)
+    {
+        run_victims(cases[c].policy, 2);
+        int ok = 1;
+        for (int t = 0; t < 3; t++)
+            ok &= victim_results[t] == (cases[c].preempted[t] ? REMAN_PREEMPTED : 0);
+        check(cases[c].what, ok);
+    }
+
+    // With single-instance resources thread 1 closes two wait-for cycles
+    // at once; which victims break them depends on the order they are
+    // found in, but none of the requests may time out
+    run_victims(REMAN_VICTIM_YOUNGEST, 1);
+    int preempted = 0, finished = 1;
+    for (int t = 0; t < 3; t++)
+    {
+        preempted += victim_results[t] == REMAN_PREEMPTED;
+        finished &= victim_results[t] == 0 || victim_results[t] == REMAN_PREEMPTED;
+    }
+    check("wait-for graph: both cycles through thread 1 broken", finished && preempted > 0);
+}
+
+// Grant order: thread 0 holds R0 while threads 1, 2 and 3 queue for it, in
+// that order, asking for R0 to R2, R0 and R1, and R0 alone, with priorities
+// 1, 3 and 2. R0 has one instance, so they are granted one at a time as
+// each one releases.
+pthread_mutex_t order_lock = PTHREAD_MUTEX_INITIALIZER;
+int order_next, order_seen[4];
+
+void *order_thread(void *a)
+{
+    int t = (int)(long)a;
+    int claim[3] = {1, 1, 1};
+    int wanted[4][3] = {{1, 0, 0}, {1, 1, 1}, {1, 1, 0}, {1, 0, 0}};
+    int prio[4] = {0, 1, 3, 2};
+
+    reman_connect(t);
+    reman_set_priority(prio[t]);
+    reman_claim(claim);
+    usleep(t * 30000); // Thread 0 first, then the waiters in tid order
+    reman_request(wanted[t]);
+    if (t == 0)
+        usleep(100000); // Until all three wait
+    pthread_mutex_lock(&order_lock);
+    order_seen[order_next++] = t;
+    pthread_mutex_unlock(&order_lock);
+    reman_release(wanted[t]);
+    reman_disconnect();
+    return NULL;
+}
+
+// Starvation: threads 1 and 2 keep R0 busy between them while thread 3
+// asks for starved_units of it. passed counts their grants, and
+// starved_passed those made while thread 3 waited.
+pthread_mutex_t turn_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t turn_cond = PTHREAD_COND_INITIALIZER;
+int turn, grant_done, starved_units, starved_result;
+long passed, starved_passed;
+
+void *starved_thread(void *a)
+{
+    int want[1] = {starved_units};
+
+    reman_connect(3);
+    reman_claim(want);
+    usleep(20000); // Let the other two get going
+    long before = __atomic_load_n(&passed, __ATOMIC_SEQ_CST);
+    starved_result = reman_request_timed(want, 3000);
+    starved_passed = __atomic_load_n(&passed, __ATOMIC_SEQ_CST) - before;
+    pthread_mutex_lock(&turn_lock);
+    __atomic_store_n(&grant_done, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&turn_cond);
+    pthread_mutex_unlock(&turn_lock);
+    if (starved_result == 0)
+        reman_release(want);
+    reman_disconnect();
+    return NULL;
+}
+
+// Aging: threads 1 and 2, priority 2, hand R0 back and forth, each holding
+// it long enough for the other to queue again, so every release finds one
+// of them waiting next to thread 3, priority 0
+void *aging_thread(void *a)
+{
+    int t = (int)(long)a;
+    int one[1] = {1};
+
+    reman_connect(t);
+    reman_set_priority(2);
+    reman_claim(one);
+    while (!__atomic_load_n(&grant_done, __ATOMIC_SEQ_CST))
+    {
+        reman_request(one);
+        __atomic_add_fetch(&passed, 1, __ATOMIC_SEQ_CST);
+        usleep(2000);
+        reman_release(one);
+    }
+    reman_disconnect();
+    return NULL;
+}
+
+// Reservation: R0 has two instances and threads 1 and 2 take one each. Only
+// the thread whose turn it is releases and requests again, so one instance
+// stays held and thread 3, which wants both, never fits on its own. The
+// other thread gives its instance up only when the turn does not come back.
+void *reserve_thread(void *a)
+{
+    int me = (int)(long)a - 1;
+    int one[1] = {1};
+
+    reman_connect(me + 1);
+    reman_claim(one);
+    reman_request(one);
+    __atomic_add_fetch(&passed, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&turn_lock);
+    while (!grant_done)
+    {
+        if (turn != me)
+        {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += 1;
+            if (pthread_cond_timedwait(&turn_cond, &turn_lock, &until) != ETIMEDOUT)
+                continue;
+            // The other thread waits behind thread 3: give way
+        }
+        pthread_mutex_unlock(&turn_lock);
+        reman_release(one);
+        reman_request(one);
+        __atomic_add_fetch(&passed, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&turn_lock);
+        turn = 1 - me;
+        pthread_cond_broadcast(&turn_cond);
+    }
+    pthread_mutex_unlock(&turn_lock);
+    reman_release(one);
+    reman_disconnect();
+    return NULL;
+}
+
+// Run thread 3 for units of R0 against threads 1 and 2 running other
+void run_starved(int units, void *(*other)(void *))
+{
+    pthread_t th[3];
+    int cap[1] = {units};
+
+    reman_init(4, 1, REMAN_DETECT);
+    reman_set_capacity(cap);
+    passed = 0;
+    turn = 0;
+    grant_done = 0;
+    starved_units = units;
+    pthread_create(&th[0], NULL, other, (void *)1L);
+    pthread_create(&th[1], NULL, other, (void *)2L);
+    pthread_create(&th[2], NULL, starved_thread, NULL);
+    for (int i = 0; i < 3; i++)
+        pthread_join(th[i], NULL);
+    reman_destroy();
+}
+
+void grant_order()
+{
+    struct
+    {
+        int policy;
+        const char *what;
+        int order[4];
+    } cases[] = {
+        {REMAN_GRANT_FIFO, "FIFO grants threads 1, 2, 3", {0, 1, 2, 3}},
+        {REMAN_GRANT_PRIORITY, "PRIORITY grants threads 2, 3, 1", {0, 2, 3, 1}},
+        {REMAN_GRANT_SHORTEST, "SHORTEST grants threads 3, 2, 1", {0, 3, 2, 1}},
+    };
+
+    printf("grant order\n");
+    for (int c = 0; c < 3; c++)
+    {
+        pthread_t th[4];
+
+        reman_set_grant_policy(cases[c].policy);
+        reman_init(4, 3, REMAN_DETECT);
+        order_next = 0;
+        for (long t = 0; t < 4; t++)
+            pthread_create(&th[t], NULL, order_thread, (void *)t);
+        for (int t = 0; t < 4; t++)
+            pthread_join(th[t], NULL);
+        check(cases[c].what, order_next == 4 && memcmp(order_seen, cases[c].order, sizeof(order_seen)) == 0);
+        reman_destroy();
+    }
+
+    // Aging lifts thread 3 one priority step every 16 grants it is passed
+    // over, so it draws level with threads 1 and 2 after 32 and then wins
+    // on arrival order
+    reman_set_grant_policy(REMAN_GRANT_PRIORITY);
+    run_starved(1, aging_thread);
+    check("aging grants priority 0 over 2 after 32 grants", starved_result == 0);
+    check("... and not before", starved_passed >= 32 && starved_passed <= 40);
+
+    // After 256 grants passed over, thread 3 reserves R0 and the next
+    // request of a thread holding nothing queues behind it
+    reman_set_grant_policy(REMAN_GRANT_FIFO);
+    run_starved(2, reserve_thread);
+    check("a starved request for 2 units reserves R0", starved_result == 0);
+    check("... after 256 grants", starved_passed >= 256 && starved_passed <= 264);
+}
+
+void ordered()
+{
+    int claim[4] = {1, 1, 1, 1};
+    int r[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+    int r13[4] = {0, 1, 0, 1};
+    int sizes[2] = {2, 2};
+
+    printf("ordered acquisition\n");
+    reman_init(1, 4, REMAN_ORDERED);
+    reman_connect(0);
+    reman_claim(claim);
+    reman_request(r[2]);
+    check("request below a held resource is denied", reman_request(r[1]) == -1);
+    check("request above it is granted", reman_request(r[3]) == 0);
+    reman_release(r[3]);
+
+    struct reman_op down[2] = {{REMAN_OP_RELEASE, r[2]}, {REMAN_OP_REQUEST, r[1]}};
+    check("batch releasing the top one may request below it", reman_batch(down, 2) == 0);
+    check("... and holds R1 instead of R2", reman_release(r[2]) == -1 && reman_request(r[3]) == 0);
+
+    // Holding R1 and R3
+    struct reman_op above[2] = {{REMAN_OP_RELEASE, r[3]}, {REMAN_OP_REQUEST, r[2]}};
+    check("batch keeping R1 may request R2 above it", reman_batch(above, 2) == 0);
+    reman_release(r[2]);
+    reman_request(r[3]);
+
+    struct reman_op below[2] = {{REMAN_OP_RELEASE, r[1]}, {REMAN_OP_REQUEST, r[2]}};
+    check("batch keeping R3 may not request R2 below it", reman_batch(below, 2) == -1);
+    check("... and applies nothing", reman_release(r13) == 0);
+    reman_disconnect();
+    reman_destroy();
+
+    // The same across groups, where the batch only locks the lower one
+    reman_set_groups(2, sizes);
+    reman_init(1, 4, REMAN_ORDERED);
+    reman_connect(0);
+    reman_claim(claim);
+    reman_request(r[3]);
+    struct reman_op lower[1] = {{REMAN_OP_REQUEST, r[0]}};
+    check("batch in a group below a held resource is denied", reman_batch(lower, 1) == -1);
+    struct reman_op swap[2] = {{REMAN_OP_RELEASE, r[3]}, {REMAN_OP_REQUEST, r[0]}};
+    check("... unless it releases that resource", reman_batch(swap, 2) == 0);
+    reman_release(r[0]);
+    reman_disconnect();
+    reman_destroy();
+    reman_set_groups(0, NULL);
+}
+
+void traces()
+{
+    int one[1] = {1};
+    struct reman_trace_rec recs[16];
+    int expect[] = {REMAN_TRACE_CONNECT, REMAN_TRACE_CLAIM, REMAN_TRACE_REQUEST,
+                    REMAN_TRACE_RELEASE, REMAN_TRACE_DISCONNECT};
+    int nexpect = sizeof(expect) / sizeof(expect[0]);
+
+    printf("trace\n");
+    reman_set_trace(64, NULL);
+    reman_init(1, 1, REMAN_AVOID);
+    reman_connect(0);
+    reman_claim(one);
+    reman_request(one);
+    reman_release(one);
+    reman_disconnect();
+
+    int n = reman_trace_read(recs, 16);
+    int in_order = n == nexpect;
+    for (int i = 0; i < n && in_order; i++)
+        in_order = recs[i].op == expect[i] && recs[i].tid == 0 &&
+                   (i == 0 || recs[i].ts_ns >= recs[i - 1].ts_ns);
+    check("connect, claim, request, release, disconnect", in_order);
+    check("... the request was granted", n > 2 && recs[2].result == 0);
+    check("a second read finds nothing new", reman_trace_read(recs, 16) == 0);
+
+    reman_destroy();
+    reman_set_trace(0, NULL);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "child") == 0)
+        return shared_child();
+
+    setvbuf(stdout, NULL, _IONBF, 0); // Before fork, so nothing is printed twice
+    timed_requests();
+    batches();
+    shared_mode();
+    snapshots();
+    traces();
+    victims();
+    grant_order();
+    ordered();
+
+    printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+    return failures;
+}
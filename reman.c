@@ -3,286 +3,2574 @@
 #include <stdlib.h>
 #include <time.h>
 #include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "reman.h"
+#include "reman_vec.h"
+#include "reman_trace.h"
 
-#define MAXR 1000
-#define MAXT 100
+#define CACHE_LINE 64
 
-int num_threads, num_resources, deadlock_avoidance;
-int available[MAXR];
-int allocated[MAXT][MAXR];
-int requested[MAXT][MAXR];
-int max_claim[MAXT][MAXR];
-pthread_mutex_t lock;
-pthread_cond_t cond[MAXT];
-int thread_status[MAXT] = {0};
-pthread_t thread_ids[MAXT];
+// All per-thread and per-resource state lives in one cache-line-aligned
+// arena sized by reman_init. Matrix rows are padded to REMAN_ROW_ALIGN ints
+// (reman.h, shared with the fixed kernels) so every row starts on its own
+// cache line and can be scanned in whole vectors.
+static int num_threads, num_resources, deadlock_avoidance;
+static int ordered_acquisition; // REMAN_ORDERED: requests must climb in resource index
+static int row_stride;   // ints per matrix row
+static void *arena;
+static size_t arena_size;
+static int *capacity;    // Instances of each resource type
+static int *available;
+static int *allocated;   // num_threads rows of row_stride ints
+static int *requested;
+static int *max_claim;
 
-#define TIMEOUT 5 // Timeout for condition variable wait
+#define ROW(m, t) ((m) + (size_t)(t) * row_stride)
 
-int find_tid() {
-    pthread_t self = pthread_self();
-    for (int i = 0; i < num_threads; i++) {
-        if (pthread_equal(thread_ids[i], self)) {
-            return i;
+// Manager-wide scalars live at the start of the arena next to the arrays,
+// so a process that attaches to a shared arena sees the same ones. The
+// geometry is recorded for attaching processes to rebuild the layout.
+#define CONTROL_MAGIC 0x52454d414e010000ULL
+struct control {
+    uint64_t magic;     // Written last by the creator
+    size_t arena_size;
+    int t_count, r_count, avoid, groups, stats;
+    int cross_claims;   // Threads whose claim spans shards
+    int ncross;         // Threads blocked on a cross-shard request
+    int cross_reserved; // Reservation among the cross-shard waiters
+    int wfg_active;     // Detection mode and every capacity is 1
+    int unit_rows;      // Every capacity is 1, so the bitmaps are the rows
+    int birth_clock;
+    long ticket_clock;  // Arrival order of blocked requests
+    int victim_policy, grant_policy;
+    pthread_mutex_t detect_lock;
+};
+static struct control *ctl;
+
+// Neither avoidance nor ordered acquisition keeps deadlock out, so it has
+// to be detected
+static int detection_mode() {
+    return !deadlock_avoidance && !ordered_acquisition;
+}
+
+// Sparse view of the matrices: one bit per column that is nonzero in the
+// thread's row, so the per-thread scans only visit columns actually in use
+static int nz_words;     // Bitmap words in use, (num_resources + 63) / 64
+static int nz_stride;    // Bitmap words per row, padded to a cache line
+static uint64_t *alloc_nz; // ROW(allocated, t)[i] != 0
+static uint64_t *req_nz;   // ROW(requested, t)[i] != 0
+static uint64_t *claim_nz; // ROW(max_claim, t)[i] != 0
+
+#define ROW_NZ(m, t) ((m) + (size_t)(t) * nz_stride)
+
+// Resource groups. Each shard owns the resource columns [lo, hi) and has its
+// own lock, fast-path gate, waiter list, cached safe sequence and scratch
+// rows. Without reman_set_groups there is a single shard over everything.
+// The arena may be mapped at a different address in every process, so the
+// shared scalars live in a shard_state in the arena and each process keeps
+// its own struct shard of pointers into it.
+struct shard_state {
+    pthread_mutex_t lock;
+    int lo, hi;
+    int nwaiting;        // Threads blocked on this shard, cross-shard ones included
+    int safe_seq_valid;  // 0 when safe_seq must be recomputed
+    long grants;         // Requests granted in this shard, the aging clock
+    int reserved;        // Starving waiter nothing may overtake, -1 if none
+    unsigned version;    // Odd while the lock holder may change the shard
+
+    // Detection-mode fast path. Uncontended requests and releases within
+    // one shard update available[] with atomics and the caller's own
+    // allocation row without the lock. Whoever holds the lock closes the
+    // gate and waits until every fast operation that started is done, so
+    // code under the lock sees a stable state. While threads are blocked on
+    // the shard the fast path is off, so releases always reach
+    // wake_waiters() and new requests cannot overtake the waiters. The
+    // counters only grow, so observers can also tell that none ran.
+    unsigned fast_started __attribute__((aligned(CACHE_LINE)));
+    unsigned fast_done;
+    int fast_gate_closed;
+
+    int combiner __attribute__((aligned(CACHE_LINE))); // 1 while a thread combines for the scope
+} __attribute__((aligned(CACHE_LINE)));
+
+struct shard {
+    struct shard_state *st;
+    int lo, hi;          // Copy of st->lo, st->hi
+    uint64_t *waiters;   // Bit per tid blocked on this shard alone
+    int *safe_seq;       // Cached safe sequence from the last full safety check
+    int *safe_pos;       // Position of each tid in safe_seq
+    int *work_row;       // Scratch row for safety checks and detection
+    int *prefix_work;    // Scratch row for the incremental safety check
+    uint64_t *work_bits; // Bitmap versions of the two, for unit rows
+    uint64_t *prefix_bits;
+    int *batch_held;     // Scratch row for validating reman_batch
+    int *finish;         // Scratch per-thread flags
+    int *seq;            // Scratch per-thread order
+    int *parent;         // Scratch per-thread links for the wait-for search
+    int *order;          // Scratch waiter ranking for the grant scheduler
+    uint64_t *published; // Bit per tid with an operation for this scope's combiner
+    uint64_t *drained;   // Scratch copy of published for one combining pass
+};
+
+static struct shard *shards;
+static int num_shards;
+static struct shard *global_shard; // Cache and scratch of the all-shards scope
+static int *group_sizes;       // From reman_set_groups, NULL for a single group
+static int group_count;
+static int tid_words;          // Words in a per-tid bitmap, (num_threads + 63) / 64
+
+// What an operation has locked: one shard, or every shard in order for
+// anything that spans groups. Scans cover the columns [c0, c1); scratch and
+// the cached safe sequence come from sh, which for the global scope is a
+// lockless extra shard when there are several.
+struct scope {
+    struct shard *sh;
+    int first, last;    // Shards held
+    int c0, c1;
+};
+
+// Claims that span shards make per-shard safety inexact, so avoidance-mode
+// operations then go through the global scope. cross_claims and ncross
+// (in ctl) are written only with every shard locked, so holding any one
+// shard lock is enough to read them. scope_for reads cross_claims unlocked,
+// only as a hint that scope_enter and combine_in_scope check again.
+static int *claim_shard;       // Shard of each thread's claim, -1 none, -2 several
+static uint64_t *cross_waiters; // Bit per tid blocked on a cross-shard request
+
+// With single-instance resources in detection mode, deadlock is exactly a
+// cycle in the wait-for graph. Its edges are kept implicitly: a blocked
+// thread waits for holder[i] of every resource i in its pending request.
+// holder[] is maintained only while wfg_active.
+static int *holder;            // Thread holding each resource, -1 when free
+
+// Blocked threads park on their own cond[tid] under park_lock[tid]. A
+// waker either grants the request on the thread's behalf and clears
+// waiting[tid], or, for cross-shard waiters it cannot grant, just hands
+// over the token so the thread re-checks with every shard locked.
+static pthread_mutex_t *park_lock;
+static pthread_cond_t *cond;
+static int *park_token;
+static int *thread_status;
+static __thread int my_tid = -1; // tid bound to the calling thread by reman_connect
+static __thread int my_generation; // manager_generation when my_tid was bound
+static int manager_generation = 0; // Bumped by reman_destroy, so bindings lapse
+static int *waiting;            // 1 while the thread is blocked in reman_request
+static int *wait_shard;         // Shard the thread is blocked on, -1 for cross-shard
+
+// Shared mode: the arena is a named POSIX shared memory segment that other
+// processes map with reman_attach, and every lock and condition variable in
+// it is process-shared. The mutexes are also robust, so a lock whose owner
+// died is taken over, and the threads of dead processes, known by
+// owner_pid[], are reaped: what they held goes back to available[]. The
+// fast path is off, since a dead process could leave a fast operation open.
+#define SHARED_NONE 0
+#define SHARED_CREATOR 1
+#define SHARED_ATTACHED 2
+static const char *shared_name = NULL; // From reman_set_shared
+static char *segment_name = NULL;      // Copy of the name the creator removes again
+static int shared_role = SHARED_NONE;
+static pid_t *owner_pid;        // Process of each connected tid, 0 if none
+
+// Deadlock recovery. The victim among the deadlocked threads is chosen by
+// victim_policy; ties go to the thread preempted least often so far, then
+// to the lower tid. A preempted thread was blocked, so its pending request
+// is withdrawn and fails with REMAN_PREEMPTED.
+static int victim_policy = REMAN_VICTIM_FIRST; // Setting, in effect in ctl
+static int *priority;           // From reman_set_priority, lowest is preempted first
+static int *birth;              // Connect order, highest is youngest
+static int *preempt_count;      // Times each thread was chosen as victim
+static int *preempted;          // Set when a blocked request is withdrawn by recovery
+
+// Grant scheduler. When resources free up, the waiters of a list are
+// ranked by grant_policy and granted in that order wherever they fit. A
+// waiter ages with every grant made in its scope while it waits, which
+// raises its rank under the priority and shortest-first policies. Once it
+// has waited through STARVE_GRANTS grants it may reserve the list: while it
+// is the best-ranked waiter that does not fit, threads holding nothing at
+// all are not granted anything and queue behind it. Threads that hold
+// resources, in any shard, are never deferred, so a reservation cannot
+// close a wait cycle that detection would not see.
+#define AGING_GRANTS 16   // Grants per step of aging
+#define STARVE_GRANTS 256 // Grants after which a waiter may reserve
+static int grant_policy = REMAN_GRANT_FIFO; // Setting, in effect in ctl
+static long *ticket;            // Arrival of each waiter
+static long *since;             // Grants in the waiter's scope when it blocked
+static long *rank_key;          // Scratch ranking key, lower is served first
+
+// Flat combining, when reman_set_combining(1) was called before reman_init.
+// A thread about to lock a scope for a request or release first publishes
+// the operation in its own slot and marks it in the scope's published
+// bitmap. One thread at a time per scope becomes the combiner: it takes the
+// locks once, applies every operation published for the scope, releases
+// first so that a single wake pass covers them all, and hands each result
+// back through the slot. The others spin on their own slot rather than on
+// the mutex, so the lock and the state stay in the combiner's cache for the
+// whole pass. Requests are served in grant_policy order, ties in the order
+// they were published; one that cannot be granted on the spot is put on
+// the waiter list by the combiner and comes back as COMBINE_QUEUED, and its
+// thread then waits like any blocked one. Off in shared mode, where a dead
+// combiner would strand the slots.
+#define COMBINE_IDLE 0
+#define COMBINE_PUBLISHED 1
+#define COMBINE_DONE 2
+#define COMBINE_SLOW 1   // Result: take the ordinary locked path
+#define COMBINE_QUEUED 2 // Result: blocked, wait for the grant
+#define COMBINE_PASSES 4 // Drains of the published bitmap per combiner turn
+struct combine_slot {
+    int state;   // COMBINE_*, written by the owner except for COMBINE_DONE
+    int op;      // REMAN_OP_REQUEST or REMAN_OP_RELEASE
+    int shard;   // vector_shard() of vector
+    int wait_ms; // Of a request, as for acquire_locked
+    long ticket; // Arrival order of a request
+    int result;
+    int *vector;
+} __attribute__((aligned(CACHE_LINE)));
+static int combine_requested = 0;
+static int combining = 0;
+static struct combine_slot *combine_slots;
+
+// Kernels compiled for a fixed geometry (reman_fixed.h). They see whole
+// matrices, so they replace only scans over every column, and only the int
+// ones: with unit rows the bitmap scans are faster still.
+static const struct reman_fixed *fixed_kernels = NULL; // From reman_set_fixed
+static int fixed_active = 0;    // fixed_kernels match the geometry
+
+// Diagnostics go to the trace rings instead of stdio. Ring t belongs to the
+// thread connected as t; TRACE_MANAGER is written only by detection passes,
+// which detect_lock serializes.
+static int trace_capacity = 0;
+static const char *trace_path = NULL;
+static int tracing = 0;
+#define TRACE_MANAGER num_threads
+#define TRACE(ring, op, tid, vector, result)                                   \
+    do {                                                                       \
+        if (tracing)                                                           \
+            reman_trace_emit(ring, op, tid, vector, num_resources, result);    \
+    } while (0)
+
+// Metrics, kept only when reman_set_stats(1) was called before reman_init.
+// Each connected thread counts into its own slot, and slot num_threads
+// belongs to detection passes, which detect_lock serializes. Slots have a
+// single writer each, so updates are plain relaxed stores and reman_stats
+// merges them on read. Wait histograms are shared per resource and only
+// touched by requests that blocked.
+struct stats_slot {
+    uint64_t requests, grants, denies, blocks, preemptions, timeouts, releases, fast_path, combined;
+    uint64_t lock_acquires, lock_wait_ns, lock_hold_ns;
+    uint64_t safety_checks, safety_ns;
+    uint64_t detections, detect_ns;
+} __attribute__((aligned(CACHE_LINE)));
+
+static int stats_enabled = 0;
+static int stats_requested = 0;
+static struct stats_slot *stats_slots;
+static uint64_t *wait_hist;     // REMAN_STATS_BUCKETS counters per resource
+static __thread struct stats_slot *my_stats; // Slot of the calling thread, if any
+static __thread uint64_t stats_locked_at;    // When the held scope was locked
+static uint64_t *blocked_since;  // When each blocked thread started waiting, 0 if not
+
+#define STATS_MANAGER num_threads
+#define STAT_ADD(slot, field, v)                                               \
+    __atomic_store_n(&(slot)->field, (slot)->field + (v), __ATOMIC_RELAXED)
+
+#define STAT(field)                                                            \
+    do {                                                                       \
+        if (stats_enabled && my_stats != NULL)                                 \
+            STAT_ADD(my_stats, field, 1);                                      \
+    } while (0)
+
+static uint64_t stats_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// Count a request outcome for the calling thread
+static void stats_count(int result) {
+    if (!stats_enabled || my_stats == NULL)
+        return;
+    STAT_ADD(my_stats, requests, 1);
+    if (result == 0)
+        STAT_ADD(my_stats, grants, 1);
+    else if (result == REMAN_PREEMPTED)
+        STAT_ADD(my_stats, preemptions, 1);
+    else if (result == REMAN_TIMEDOUT)
+        STAT_ADD(my_stats, timeouts, 1);
+    else
+        STAT_ADD(my_stats, denies, 1);
+}
+
+// Background deadlock detector (detection mode only). detect_wait_lock is a
+// leaf lock guarding detect_pending; detect_lock serializes detection passes
+// and is always taken before any shard lock.
+static int detect_period_ms = 0;   // 0 disables the detector thread
+static int detector_running = 0;
+static int detect_pending = 0;     // Set when a thread blocks, wakes the detector early
+static pthread_t detector_thread;
+static pthread_cond_t detect_cond;
+static pthread_mutex_t detect_wait_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Bits of bitmap word w that fall inside the scope's columns. Shard
+// boundaries need not be word aligned, so the edge words are shared with
+// the neighbouring shard.
+static uint64_t scope_bits(struct scope *sc, int w) {
+    uint64_t bits = ~(uint64_t)0;
+    if (w == sc->c0 / 64)
+        bits &= ~(uint64_t)0 << (sc->c0 % 64);
+    if (w == (sc->c1 - 1) / 64 && sc->c1 % 64 != 0)
+        bits &= ~(uint64_t)0 >> (64 - sc->c1 % 64);
+    return bits;
+}
+
+// Iterate i over the set columns of a nonzero bitmap within the scope. A
+// break only leaves the current word, so loops that stop early should
+// return instead.
+#define FOR_EACH_NZ(sc, mask, i)                                                  \
+    for (int w_ = (sc)->c0 / 64; w_ <= ((sc)->c1 - 1) / 64; w_++)                 \
+        for (uint64_t b_ = __atomic_load_n(&(mask)[w_], __ATOMIC_RELAXED) &        \
+                           scope_bits(sc, w_);                                    \
+             b_ && ((i) = w_ * 64 + __builtin_ctzll(b_), 1); b_ &= b_ - 1)
+
+// Iterate t over the set tids of a per-tid bitmap
+#define FOR_EACH_TID(mask, t)                                                     \
+    for (int w_ = 0; w_ < tid_words; w_++)                                        \
+        for (uint64_t b_ = (mask)[w_];                                            \
+             b_ && ((t) = w_ * 64 + __builtin_ctzll(b_), 1); b_ &= b_ - 1)
+
+#define TID_SET(mask, t) ((mask)[(t) / 64] |= (uint64_t)1 << ((t) % 64))
+#define TID_CLEAR(mask, t) ((mask)[(t) / 64] &= ~((uint64_t)1 << ((t) % 64)))
+
+// Store the scope's bits of a bitmap word, leaving the neighbour's alone
+static void nz_store(struct scope *sc, uint64_t mask[], int w, uint64_t value) {
+    uint64_t bits = scope_bits(sc, w);
+    if (bits == ~(uint64_t)0) {
+        __atomic_store_n(&mask[w], value, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_fetch_and(&mask[w], ~(bits & ~value), __ATOMIC_RELAXED);
+    __atomic_fetch_or(&mask[w], value & bits, __ATOMIC_RELAXED);
+}
+
+// Rebuild the scope's part of a nonzero bitmap from a matrix row
+static void nz_rebuild(struct scope *sc, const int row[], uint64_t mask[]) {
+    if (sc->c0 % 64 == 0 && (sc->c1 % 64 == 0 || sc->c1 == num_resources)) {
+        // Whole words are ours
+        reman_vec_nz_mask(row + sc->c0, sc->c1 - sc->c0, mask + sc->c0 / 64);
+        return;
+    }
+    for (int w = sc->c0 / 64; w <= (sc->c1 - 1) / 64; w++) {
+        uint64_t value = 0;
+        int from = w * 64 > sc->c0 ? w * 64 : sc->c0;
+        int to = w * 64 + 64 < sc->c1 ? w * 64 + 64 : sc->c1;
+        for (int i = from; i < to; i++) {
+            if (row[i] != 0)
+                value |= (uint64_t)1 << (i % 64);
         }
+        nz_store(sc, mask, w, value);
     }
-    return -1;
 }
 
-int is_safe_state() {
-    int work[MAXR];
-    int finish[MAXT] = {0}; // Tracks whether each thread can finish
+static void nz_clear(struct scope *sc, uint64_t mask[]) {
+    for (int w = sc->c0 / 64; w <= (sc->c1 - 1) / 64; w++) {
+        nz_store(sc, mask, w, 0);
+    }
+}
 
+// A row is scanned densely with the vector kernels once more than one in
+// DENSE_RATIO of its columns is set, and sparsely through its bitmap otherwise
+#define DENSE_RATIO 16
 
-    // Initialize work array to represent currently available resources
-    for (int i = 0; i < num_resources; i++) {
-        work[i] = available[i];
+static int row_dense(struct scope *sc, uint64_t mask[]) {
+    int bits = 0;
+    for (int w = sc->c0 / 64; w <= (sc->c1 - 1) / 64; w++) {
+        bits += __builtin_popcountll(__atomic_load_n(&mask[w], __ATOMIC_RELAXED) & scope_bits(sc, w));
+    }
+    return bits * DENSE_RATIO > sc->c1 - sc->c0;
+}
+
+static int nz_empty(struct scope *sc, uint64_t mask[]) {
+    for (int w = sc->c0 / 64; w <= (sc->c1 - 1) / 64; w++) {
+        if (__atomic_load_n(&mask[w], __ATOMIC_RELAXED) & scope_bits(sc, w))
+            return 0;
+    }
+    return 1;
+}
+
+static void scope_single(struct scope *sc, int s) {
+    sc->sh = &shards[s];
+    sc->first = sc->last = s;
+    sc->c0 = shards[s].lo;
+    sc->c1 = shards[s].hi;
+}
+
+static void scope_global(struct scope *sc) {
+    sc->sh = global_shard;
+    sc->first = 0;
+    sc->last = num_shards - 1;
+    sc->c0 = 0;
+    sc->c1 = num_resources;
+}
+
+// Scope for an operation whose vector touches only shard s (-1: several)
+static void scope_for(struct scope *sc, int s) {
+    if (s < 0 || (deadlock_avoidance && __atomic_load_n(&ctl->cross_claims, __ATOMIC_RELAXED)))
+        scope_global(sc);
+    else
+        scope_single(sc, s);
+}
+
+static int scope_is_global(struct scope *sc) {
+    return sc->first != sc->last || num_shards == 1;
+}
+
+// Whether the fixed-geometry kernels can scan the scope
+static int fixed_covers(struct scope *sc) {
+    return fixed_active && sc->c0 == 0 && sc->c1 == num_resources;
+}
+
+// Shard holding every nonzero entry of vector, -1 if it spans shards
+static int vector_shard(const int vector[]) {
+    if (num_shards == 1)
+        return 0;
+    int found = -1;
+    for (int s = 0; s < num_shards; s++) {
+        for (int i = shards[s].lo; i < shards[s].hi; i++) {
+            if (vector[i] != 0) {
+                if (found >= 0)
+                    return -1;
+                found = s;
+                break;
+            }
+        }
+    }
+    return found < 0 ? 0 : found;
+}
+
+// Whether no fast operation is in flight. done is read first since it
+// never gets ahead of started.
+static int fast_idle(struct shard_state *st) {
+    unsigned done = __atomic_load_n(&st->fast_done, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&st->fast_started, __ATOMIC_SEQ_CST) == done;
+}
+
+static void gate_close(struct shard *sh) {
+    if (deadlock_avoidance || shared_role != SHARED_NONE)
+        return;
+    __atomic_store_n(&sh->st->fast_gate_closed, 1, __ATOMIC_SEQ_CST);
+    while (!fast_idle(sh->st)) {
+        sched_yield();
+    }
+}
+
+static void gate_open(struct shard *sh) {
+    if (deadlock_avoidance || shared_role != SHARED_NONE)
+        return;
+    __atomic_store_n(&sh->st->fast_gate_closed, 0, __ATOMIC_RELEASE);
+}
+
+// Lock a manager mutex. Only shared-mode mutexes are robust: if the owner
+// died holding one, it is made consistent and *orphaned is set, when given.
+static void robust_lock(pthread_mutex_t *m, int *orphaned) {
+    if (pthread_mutex_lock(m) == EOWNERDEAD) {
+        pthread_mutex_consistent(m);
+        if (orphaned != NULL)
+            *orphaned = 1;
+    }
+}
+
+static void resync_locked(struct scope *sc);
+static int reap_locked(struct scope *sc);
+
+// Take the scope's shard locks in index order, shut out the fast path and
+// make the versions odd for observers. A lock left behind by a dead
+// process makes its threads be reaped first.
+static void scope_lock(struct scope *sc) {
+    uint64_t t0 = stats_enabled && my_stats != NULL ? stats_now() : 0;
+    int orphaned = 0;
+    for (int s = sc->first; s <= sc->last; s++) {
+        struct shard_state *st = shards[s].st;
+        robust_lock(&st->lock, &orphaned);
+        gate_close(&shards[s]);
+        // Odd even if a dead holder left it odd
+        __atomic_store_n(&st->version, (st->version + 1) | 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+    if (orphaned) {
+        resync_locked(sc);
+        reap_locked(sc);
+    }
+    if (t0 != 0) {
+        stats_locked_at = stats_now();
+        STAT_ADD(my_stats, lock_acquires, 1);
+        STAT_ADD(my_stats, lock_wait_ns, stats_locked_at - t0);
+    }
+}
+
+static void scope_unlock(struct scope *sc) {
+    if (stats_enabled && my_stats != NULL && stats_locked_at != 0) {
+        STAT_ADD(my_stats, lock_hold_ns, stats_now() - stats_locked_at);
+        stats_locked_at = 0;
+    }
+    for (int s = sc->last; s >= sc->first; s--) {
+        struct shard_state *st = shards[s].st;
+        __atomic_store_n(&st->version, st->version + 1, __ATOMIC_RELEASE);
+        gate_open(&shards[s]);
+        pthread_mutex_unlock(&st->lock);
+    }
+}
+
+// Lock the scope for an operation on shard s, falling back to the global
+// scope if a claim made the single-shard route invalid in the meantime
+static void scope_enter(struct scope *sc, int s) {
+    scope_for(sc, s);
+    scope_lock(sc);
+    if (sc->first == sc->last && num_shards > 1 && deadlock_avoidance && ctl->cross_claims > 0) {
+        scope_unlock(sc);
+        scope_global(sc);
+        scope_lock(sc);
+    }
+}
+
+// Enter the fast path; returns 0 when the caller must take the lock instead
+static int fast_enter(struct shard *sh) {
+    if (deadlock_avoidance || shared_role != SHARED_NONE)
+        return 0;
+    __atomic_add_fetch(&sh->st->fast_started, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sh->st->fast_gate_closed, __ATOMIC_SEQ_CST) ||
+        __atomic_load_n(&sh->st->nwaiting, __ATOMIC_SEQ_CST) != 0) {
+        __atomic_add_fetch(&sh->st->fast_done, 1, __ATOMIC_RELEASE);
+        return 0;
+    }
+    return 1;
+}
+
+static void fast_exit(struct shard *sh) {
+    __atomic_add_fetch(&sh->st->fast_done, 1, __ATOMIC_RELEASE);
+}
+
+// Take request[] out of the shard's part of available[] with one CAS per
+// resource, rolling the already taken ones back on a shortfall. Fast path only.
+static int fast_take(struct shard *sh, int request[]) {
+    for (int i = sh->lo; i < sh->hi; i++) {
+        if (request[i] == 0)
+            continue;
+        int old = __atomic_load_n(&available[i], __ATOMIC_RELAXED);
+        do {
+            if (old < request[i]) {
+                for (int j = sh->lo; j < i; j++) {
+                    if (request[j] != 0)
+                        __atomic_add_fetch(&available[j], request[j], __ATOMIC_RELAXED);
+                }
+                return 0;
+            }
+        } while (!__atomic_compare_exchange_n(&available[i], &old, old - request[i], 1,
+                                              __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    }
+    return 1;
+}
+
+// Attributes of the manager's mutexes and condition variables. Timed
+// requests park against CLOCK_MONOTONIC deadlines, and shared locks must
+// survive their owner's death.
+static void lock_attrs(pthread_mutexattr_t *mutex_attr, pthread_condattr_t *cond_attr) {
+    pthread_mutexattr_init(mutex_attr);
+    pthread_condattr_init(cond_attr);
+    pthread_condattr_setclock(cond_attr, CLOCK_MONOTONIC);
+    if (shared_role != SHARED_NONE) {
+        pthread_mutexattr_setpshared(mutex_attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(mutex_attr, PTHREAD_MUTEX_ROBUST);
+        pthread_condattr_setpshared(cond_attr, PTHREAD_PROCESS_SHARED);
+    }
+}
+
+// Set up the parking spot of tid. A waiter that died inside
+// pthread_cond_wait keeps the condition variable busy for good, so the spot
+// of a reaped thread is set up afresh before the tid is used again.
+static void park_init(int tid) {
+    pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
+    lock_attrs(&mutex_attr, &cond_attr);
+    pthread_mutex_init(&park_lock[tid], &mutex_attr);
+    pthread_cond_init(&cond[tid], &cond_attr);
+    park_token[tid] = 0;
+    pthread_condattr_destroy(&cond_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+}
+
+static void park(int tid) {
+    robust_lock(&park_lock[tid], NULL);
+    while (!park_token[tid]) {
+        if (pthread_cond_wait(&cond[tid], &park_lock[tid]) == EOWNERDEAD)
+            pthread_mutex_consistent(&park_lock[tid]);
+    }
+    park_token[tid] = 0;
+    pthread_mutex_unlock(&park_lock[tid]);
+}
+
+// Park until unparked or until deadline (CLOCK_MONOTONIC) passes; returns
+// 0 when unparked, ETIMEDOUT otherwise
+static int park_until(int tid, const struct timespec *deadline) {
+    int ret = 0;
+    robust_lock(&park_lock[tid], NULL);
+    while (!park_token[tid] && ret != ETIMEDOUT) {
+        ret = pthread_cond_timedwait(&cond[tid], &park_lock[tid], deadline);
+        if (ret == EOWNERDEAD)
+            pthread_mutex_consistent(&park_lock[tid]);
+    }
+    if (park_token[tid]) {
+        park_token[tid] = 0;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&park_lock[tid]);
+    return ret;
+}
+
+static void unpark(int tid) {
+    robust_lock(&park_lock[tid], NULL);
+    park_token[tid] = 1;
+    pthread_cond_signal(&cond[tid]);
+    pthread_mutex_unlock(&park_lock[tid]);
+}
+
+// Constant-time lookup of the calling thread's tid; needs no lock since
+// my_tid is thread-local. A binding from a destroyed manager does not count.
+static int find_tid() {
+    if (my_tid >= 0 && my_generation != manager_generation) {
+        my_tid = -1;
+        my_stats = NULL;
+    }
+    return my_tid;
+}
+
+// Check whether the remaining need of t (claim - allocation, with tid also
+// holding delta[]) fits in work. Need is only nonzero in claimed columns.
+static int need_fits(struct scope *sc, int t, int tid, int delta[], int work[]) {
+    if (t != tid && row_dense(sc, ROW_NZ(claim_nz, t))) {
+        return reman_vec_diff_le(ROW(max_claim, t) + sc->c0, ROW(allocated, t) + sc->c0,
+                                 work + sc->c0, sc->c1 - sc->c0);
     }
 
-    
+    int i;
+    FOR_EACH_NZ(sc, ROW_NZ(claim_nz, t), i) {
+        int held = ROW(allocated, t)[i] + (t == tid ? delta[i] : 0);
+        if (ROW(max_claim, t)[i] - held > work[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Check whether the pending request of t fits in work
+static int request_fits(struct scope *sc, int t, int work[]) {
+    if (row_dense(sc, ROW_NZ(req_nz, t))) {
+        return reman_vec_le(ROW(requested, t) + sc->c0, work + sc->c0, sc->c1 - sc->c0);
+    }
+
+    int i;
+    FOR_EACH_NZ(sc, ROW_NZ(req_nz, t), i) {
+        if (ROW(requested, t)[i] > work[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Return the allocation of t to work, as when t finishes
+static void add_allocation(struct scope *sc, int work[], int t) {
+    if (row_dense(sc, ROW_NZ(alloc_nz, t))) {
+        reman_vec_add(work + sc->c0, ROW(allocated, t) + sc->c0, sc->c1 - sc->c0);
+        return;
+    }
+
+    int i;
+    FOR_EACH_NZ(sc, ROW_NZ(alloc_nz, t), i) {
+        work[i] += ROW(allocated, t)[i];
+    }
+}
+
+// Keep the safe sequence just found in seq[] for incremental checks
+static void cache_safe_seq(struct shard *sh) {
+    for (int k = 0; k < num_threads; k++) {
+        sh->safe_seq[k] = sh->seq[k];
+        sh->safe_pos[sh->seq[k]] = k;
+    }
+    sh->st->safe_seq_valid = 1;
+}
+
+// Single-instance rows. While every capacity is 1 all counts are 0 or 1,
+// so the nonzero bitmaps hold the matrices exactly, and the safety check
+// and detection keep work as a bitmap as well. A need or request then fits
+// when it has no bit outside work, and a finishing thread ORs its
+// allocation in: one word per 64 columns instead of 64 int compares.
+
+// Load word w of a bitmap the fast path may be changing
+#define NZ_WORD(mask, w) __atomic_load_n(&(mask)[w], __ATOMIC_RELAXED)
+
+// Bitmap of what is available in the scope, less minus[] when not NULL.
+// Columns outside the scope are set, so they never keep anything from
+// fitting and the scans below need no masking at the edge words.
+static void work_bits_init(struct scope *sc, uint64_t work[], uint64_t minus[]) {
+    nz_rebuild(sc, available, work);
+    for (int w = sc->c0 / 64; w <= (sc->c1 - 1) / 64; w++) {
+        uint64_t bits = scope_bits(sc, w);
+        if (minus != NULL)
+            work[w] &= ~(NZ_WORD(minus, w) & bits);
+        work[w] |= ~bits;
+    }
+}
+
+// need_fits for unit rows, with t also holding extra[] when not NULL
+static int need_fits_bits(struct scope *sc, int t, uint64_t extra[], uint64_t work[]) {
+    for (int w = sc->c0 / 64; w <= (sc->c1 - 1) / 64; w++) {
+        uint64_t need = NZ_WORD(ROW_NZ(claim_nz, t), w) & ~NZ_WORD(ROW_NZ(alloc_nz, t), w);
+        if (extra != NULL)
+            need &= ~extra[w];
+        if (need & ~work[w])
+            return 0;
+    }
+    return 1;
+}
+
+static int request_fits_bits(struct scope *sc, int t, uint64_t work[]) {
+    for (int w = sc->c0 / 64; w <= (sc->c1 - 1) / 64; w++) {
+        if (NZ_WORD(ROW_NZ(req_nz, t), w) & ~work[w])
+            return 0;
+    }
+    return 1;
+}
+
+static void add_allocation_bits(struct scope *sc, uint64_t work[], int t) {
+    for (int w = sc->c0 / 64; w <= (sc->c1 - 1) / 64; w++) {
+        work[w] |= NZ_WORD(ROW_NZ(alloc_nz, t), w);
+    }
+}
+
+// Full Banker's safety check of the state in which tid additionally holds
+// delta[]. On success the safe sequence it found replaces the cached one.
+static int is_safe_state(struct scope *sc, int tid, int delta[]) {
+    struct shard *sh = sc->sh;
+    int *work = sh->work_row;
+    int count = 0;          // Threads found to finish so far, in seq[]
+
+    if (fixed_covers(sc)) {
+        if (fixed_kernels->safe(available, allocated, max_claim, delta, tid, sh->seq) < num_threads)
+            return 0;
+        cache_safe_seq(sh);
+        return 1;
+    }
+
+    // Initialize work array to represent the resources available after the grant
+    memcpy(work + sc->c0, available + sc->c0, (size_t)(sc->c1 - sc->c0) * sizeof(int));
+    reman_vec_sub(work + sc->c0, delta + sc->c0, sc->c1 - sc->c0);
+    for (int t = 0; t < num_threads; t++) {
+        sh->finish[t] = 0; // Tracks whether each thread can finish
+    }
+
+
     int found; // Used to track progress in the loop
     do {
         found = 0; // Reset progress indicator for each pass
 
-        for (int tid = 0; tid < num_threads; tid++) {
-            if (!finish[tid]) { // Check if the thread has not yet finished
-                int can_finish = 1;
-                for (int i = 0; i < num_resources; i++) {
-                    // Check if the thread's requested resources are <= available in work
-                    if (requested[tid][i] > work[i]) {
-                        can_finish = 0;
-                        break;
-                    }
-                }
-
-                if (can_finish) {
-                  
+        for (int t = 0; t < num_threads; t++) {
+            if (!sh->finish[t]) { // Check if the thread has not yet finished
+                // Check if the thread's remaining need (claim - allocation) is <= work
+                if (need_fits(sc, t, tid, delta, work)) {
                     // Add the thread's allocated resources back to work
-                    for (int i = 0; i < num_resources; i++) {
-                        work[i] += allocated[tid][i];
+                    add_allocation(sc, work, t);
+                    if (t == tid) {
+                        int i;
+                        FOR_EACH_NZ(sc, ROW_NZ(claim_nz, t), i) {
+                            work[i] += delta[i];
+                        }
                     }
-                    finish[tid] = 1; // Mark thread as finished
+                    sh->finish[t] = 1; // Mark thread as finished
+                    sh->seq[count++] = t;
                     found = 1; // Indicate progress in this pass
                 }
             }
         }
     } while (found); // Continue until no more threads can finish
 
-   
+
     // Check if all threads can finish
+    if (count < num_threads) {
+        return 0; // Unsafe state
+    }
+
+    cache_safe_seq(sh);
+    return 1; // Safe state
+}
+
+// Incremental safety check for granting delta[] to tid. Granting only
+// shrinks work for the threads ordered before tid in the cached safe
+// sequence: at tid's own slot need and work drop by the same amount, and
+// from there on work is identical to before. So only that prefix is
+// re-checked, and the full check runs only when the prefix breaks or the
+// cache was invalidated (new claims). Releases keep the sequence valid.
+static int is_safe_grant(struct scope *sc, int tid, int delta[]) {
+    struct shard *sh = sc->sh;
+    if (!sh->st->safe_seq_valid) {
+        return is_safe_state(sc, tid, delta);
+    }
+
+    int *work = sh->prefix_work;
+    memcpy(work + sc->c0, available + sc->c0, (size_t)(sc->c1 - sc->c0) * sizeof(int));
+    reman_vec_sub(work + sc->c0, delta + sc->c0, sc->c1 - sc->c0);
+
+    for (int k = 0; k < sh->safe_pos[tid]; k++) {
+        int t = sh->safe_seq[k];
+        if (!need_fits(sc, t, -1, delta, work)) {
+            // Cached order no longer works; another order may
+            return is_safe_state(sc, tid, delta);
+        }
+        add_allocation(sc, work, t);
+    }
+    return 1; // Cached sequence stays valid after the grant
+}
+
+// is_safe_state for unit rows, tid additionally holding its pending request
+static int is_safe_state_bits(struct scope *sc, int tid) {
+    struct shard *sh = sc->sh;
+    uint64_t *work = sh->work_bits;
+    uint64_t *delta = ROW_NZ(req_nz, tid);
+    int count = 0;
+
+    work_bits_init(sc, work, delta);
+    memset(sh->finish, 0, (size_t)num_threads * sizeof(int));
+    int found;
+    do {
+        found = 0;
+        for (int t = 0; t < num_threads; t++) {
+            if (!sh->finish[t] && need_fits_bits(sc, t, t == tid ? delta : NULL, work)) {
+                add_allocation_bits(sc, work, t);
+                if (t == tid) {
+                    for (int w = sc->c0 / 64; w <= (sc->c1 - 1) / 64; w++) {
+                        work[w] |= NZ_WORD(delta, w);
+                    }
+                }
+                sh->finish[t] = 1;
+                sh->seq[count++] = t;
+                found = 1;
+            }
+        }
+    } while (found);
+
+    if (count < num_threads) {
+        return 0;
+    }
+    cache_safe_seq(sh);
+    return 1;
+}
+
+// is_safe_grant for unit rows, sharing the cached safe sequence
+static int is_safe_grant_bits(struct scope *sc, int tid) {
+    struct shard *sh = sc->sh;
+    if (!sh->st->safe_seq_valid) {
+        return is_safe_state_bits(sc, tid);
+    }
+
+    uint64_t *work = sh->prefix_bits;
+    work_bits_init(sc, work, ROW_NZ(req_nz, tid));
+    for (int k = 0; k < sh->safe_pos[tid]; k++) {
+        int t = sh->safe_seq[k];
+        if (!need_fits_bits(sc, t, NULL, work)) {
+            return is_safe_state_bits(sc, tid);
+        }
+        add_allocation_bits(sc, work, t);
+    }
+    return 1;
+}
+
+// Safety check for granting tid its pending request
+static int is_safe_request(struct scope *sc, int tid) {
+    if (ctl->unit_rows)
+        return is_safe_grant_bits(sc, tid);
+    return is_safe_grant(sc, tid, ROW(requested, tid));
+}
+
+// Check whether the pending request of tid can be granted right now.
+// Must be called with the scope locked, and a 1 result must be followed by grant().
+static int can_grant(struct scope *sc, int tid) {
+    if (!request_fits(sc, tid, available)) {
+        return 0; // Not enough free instances
+    }
+
+    if (!deadlock_avoidance) {
+        return 1;
+    }
+
+    if (!stats_enabled || my_stats == NULL) {
+        return is_safe_request(sc, tid);
+    }
+    uint64_t t0 = stats_now();
+    int safe = is_safe_request(sc, tid);
+    STAT_ADD(my_stats, safety_checks, 1);
+    STAT_ADD(my_stats, safety_ns, stats_now() - t0);
+    return safe;
+}
+
+// Move the pending request of tid into its allocation. Must be called with
+// the scope locked.
+static void grant(struct scope *sc, int tid) {
+    for (int s = sc->first; s <= sc->last; s++) {
+        shards[s].st->grants++;
+    }
+
+    int *req = ROW(requested, tid);
+    int *alloc = ROW(allocated, tid);
+    int n = sc->c1 - sc->c0;
+
+    if (row_dense(sc, ROW_NZ(req_nz, tid))) {
+        reman_vec_sub(available + sc->c0, req + sc->c0, n);
+        reman_vec_add(alloc + sc->c0, req + sc->c0, n);
+        memset(req + sc->c0, 0, (size_t)n * sizeof(int));
+    } else {
+        int i;
+        FOR_EACH_NZ(sc, ROW_NZ(req_nz, tid), i) {
+            available[i] -= req[i];
+            alloc[i] += req[i];
+            req[i] = 0;
+        }
+    }
+    if (ctl->wfg_active) {
+        int i;
+        FOR_EACH_NZ(sc, ROW_NZ(req_nz, tid), i) {
+            holder[i] = tid;
+        }
+    }
+    // A sequence cached over other columns did not see this grant
+    if (deadlock_avoidance && num_shards > 1) {
+        if (scope_is_global(sc)) {
+            for (int s = 0; s < num_shards; s++) {
+                shards[s].st->safe_seq_valid = 0;
+            }
+        } else {
+            global_shard->st->safe_seq_valid = 0;
+        }
+    }
+
+    // Counts are non-negative, so the allocation is now nonzero exactly
+    // where it was before or where the request was
+    for (int w = sc->c0 / 64; w <= (sc->c1 - 1) / 64; w++) {
+        uint64_t bits = ROW_NZ(req_nz, tid)[w] & scope_bits(sc, w);
+        __atomic_fetch_or(&ROW_NZ(alloc_nz, tid)[w], bits, __ATOMIC_RELAXED);
+    }
+    nz_clear(sc, ROW_NZ(req_nz, tid));
+}
+
+// Add the wait of blocked tid, about to be granted, to the histogram of
+// each resource in its pending request
+static void stats_wait(struct scope *sc, int tid) {
+    if (!stats_enabled || blocked_since[tid] == 0)
+        return;
+    uint64_t ns = stats_now() - blocked_since[tid] + 1;
+    int bucket = 63 - __builtin_clzll(ns);
+    if (bucket >= REMAN_STATS_BUCKETS)
+        bucket = REMAN_STATS_BUCKETS - 1;
+    int i;
+    FOR_EACH_NZ(sc, ROW_NZ(req_nz, tid), i) {
+        __atomic_add_fetch(&wait_hist[(size_t)i * REMAN_STATS_BUCKETS + bucket], 1, __ATOMIC_RELAXED);
+    }
+    blocked_since[tid] = 0;
+}
+
+// Requests granted so far in the scope's shards, the aging clock of its waiters
+static long scope_grants(struct scope *sc) {
+    long grants = 0;
+    for (int s = sc->first; s <= sc->last; s++) {
+        grants += shards[s].st->grants;
+    }
+    return grants;
+}
+
+// Put tid on the waiter list of its scope
+static void add_waiter(struct scope *sc, int tid) {
+    __atomic_store_n(&waiting[tid], 1, __ATOMIC_RELAXED);
+    ticket[tid] = __atomic_add_fetch(&ctl->ticket_clock, 1, __ATOMIC_RELAXED);
+    since[tid] = scope_grants(sc);
+    if (scope_is_global(sc) && num_shards > 1) {
+        wait_shard[tid] = -1;
+        TID_SET(cross_waiters, tid);
+        ctl->ncross++;
+    } else {
+        wait_shard[tid] = sc->first;
+        TID_SET(shards[sc->first].waiters, tid);
+    }
+    for (int s = sc->first; s <= sc->last; s++) {
+        __atomic_add_fetch(&shards[s].st->nwaiting, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void remove_waiter(int tid) {
+    struct scope sc;
+    __atomic_store_n(&waiting[tid], 0, __ATOMIC_RELAXED);
+    if (wait_shard[tid] < 0) {
+        scope_global(&sc);
+        TID_CLEAR(cross_waiters, tid);
+        ctl->ncross--;
+        if (ctl->cross_reserved == tid)
+            ctl->cross_reserved = -1;
+    } else {
+        scope_single(&sc, wait_shard[tid]);
+        TID_CLEAR(shards[wait_shard[tid]].waiters, tid);
+        if (shards[wait_shard[tid]].st->reserved == tid)
+            shards[wait_shard[tid]].st->reserved = -1;
+    }
+    for (int s = sc.first; s <= sc.last; s++) {
+        __atomic_sub_fetch(&shards[s].st->nwaiting, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void wake_waiters(struct scope *sc);
+static int must_defer(struct scope *sc, int tid);
+
+// Take the allocation of victim within the scope back into available[].
+// The victim is blocked, so its pending request is withdrawn and it wakes
+// up with REMAN_PREEMPTED.
+static void preempt(struct scope *sc, int ring, int victim) {
+    TRACE(ring, REMAN_TRACE_PREEMPT, victim, ROW(allocated, victim), 0);
+    add_allocation(sc, available, victim);
+    if (ctl->wfg_active) {
+        int i;
+        FOR_EACH_NZ(sc, ROW_NZ(alloc_nz, victim), i) {
+            holder[i] = -1;
+        }
+    }
+    memset(ROW(allocated, victim) + sc->c0, 0, (size_t)(sc->c1 - sc->c0) * sizeof(int));
+    nz_clear(sc, ROW_NZ(alloc_nz, victim));
+    preempt_count[victim]++;
+
+    if (waiting[victim]) {
+        remove_waiter(victim);
+        memset(ROW(requested, victim) + sc->c0, 0, (size_t)(sc->c1 - sc->c0) * sizeof(int));
+        nz_clear(sc, ROW_NZ(req_nz, victim));
+        preempted[victim] = 1;
+        unpark(victim);
+    }
+}
+
+// Instances of all resources in the scope held by t
+static int held_units(struct scope *sc, int t) {
+    int units = 0;
+    int i;
+    FOR_EACH_NZ(sc, ROW_NZ(alloc_nz, t), i) {
+        units += ROW(allocated, t)[i];
+    }
+    return units;
+}
+
+// Policy cost of preempting t, lower is a better victim. REMAN_VICTIM_MIN
+// is scored by the caller, which knows what each preemption unblocks.
+static long victim_cost(struct scope *sc, int t) {
+    switch (ctl->victim_policy) {
+    case REMAN_VICTIM_FEWEST:
+        return held_units(sc, t);
+    case REMAN_VICTIM_PRIORITY:
+        return priority[t];
+    case REMAN_VICTIM_YOUNGEST:
+        return -(long)birth[t];
+    case REMAN_VICTIM_MIN:
+        return 0;
+    default:
+        return t;
+    }
+}
+
+// Whether a (with cost ca) is a better victim than b (with cost cb)
+static int victim_better(int a, long ca, int b, long cb) {
+    if (b < 0)
+        return 1;
+    if (ca != cb)
+        return ca < cb;
+    if (preempt_count[a] != preempt_count[b])
+        return preempt_count[a] < preempt_count[b]; // Spread the losses
+    return a < b;
+}
+
+// Look for a wait-for cycle through tid, which has just blocked. The graph
+// had no cycle before, so any new one must pass through tid, and
+// preempting any one thread on it breaks that cycle, though others through
+// tid may remain. Threads are marked when pushed, so each is expanded once:
+// O(T + E). Returns the victim the policy picks on the cycle, or -1 if
+// there is none.
+static int wfg_cycle(struct scope *sc, int tid) {
+    struct shard *sh = sc->sh;
+    int *seen = sh->finish;
+    int *stack = sh->seq;
+    int *parent = sh->parent;
+    int top = 0;
+
+    memset(seen, 0, (size_t)num_threads * sizeof(int));
+    stack[top++] = tid;
+    seen[tid] = 1;
+    while (top > 0) {
+        int t = stack[--top];
+        int i;
+        FOR_EACH_NZ(sc, ROW_NZ(req_nz, t), i) {
+            // h may wait in another shard; its waiting flag is then only a
+            // hint, and so is the cycle, which is not conclusive then
+            int h = holder[i];
+            if (h < 0 || h == t || !__atomic_load_n(&waiting[h], __ATOMIC_RELAXED))
+                continue; // Free, or held by a thread that can still run
+            if (h == tid) {
+                // Closed the cycle: walk it back for the victim
+                int victim = -1;
+                long best = 0;
+                for (int u = t;; u = parent[u]) {
+                    long cost = victim_cost(sc, u);
+                    if (victim_better(u, cost, victim, best)) {
+                        victim = u;
+                        best = cost;
+                    }
+                    if (u == tid)
+                        break;
+                }
+                return victim;
+            }
+            if (!seen[h]) {
+                seen[h] = 1;
+                parent[h] = t;
+                stack[top++] = h;
+            }
+        }
+    }
+    return -1;
+}
+
+// Drop the pending request of tid, which is not waiting (any more)
+static void withdraw(struct scope *sc, int tid) {
+    memset(ROW(requested, tid) + sc->c0, 0, (size_t)(sc->c1 - sc->c0) * sizeof(int));
+    nz_clear(sc, ROW_NZ(req_nz, tid));
+}
+
+// Whether the process that connected t has exited. A reused pid hides the
+// death only until t is connected again.
+static int owner_dead(int t) {
+    return owner_pid[t] != 0 && kill(owner_pid[t], 0) != 0 && errno == ESRCH;
+}
+
+// Rebuild what is derived from the allocation and request rows in the
+// scope: available[], the bitmaps, the holders and the cached sequences.
+// Called when a process died holding a lock of the scope, possibly halfway
+// through a grant or release.
+static void resync_locked(struct scope *sc) {
+    int n = sc->c1 - sc->c0;
+    memcpy(available + sc->c0, capacity + sc->c0, (size_t)n * sizeof(int));
+    for (int i = sc->c0; i < sc->c1; i++) {
+        holder[i] = -1;
+    }
+    for (int t = 0; t < num_threads; t++) {
+        reman_vec_sub(available + sc->c0, ROW(allocated, t) + sc->c0, n);
+        nz_rebuild(sc, ROW(allocated, t), ROW_NZ(alloc_nz, t));
+        nz_rebuild(sc, ROW(requested, t), ROW_NZ(req_nz, t));
+        for (int i = sc->c0; ctl->wfg_active && i < sc->c1; i++) {
+            if (ROW(allocated, t)[i] != 0)
+                holder[i] = t;
+        }
+    }
+    for (int s = sc->first; s <= sc->last; s++) {
+        shards[s].st->safe_seq_valid = 0;
+    }
+    global_shard->st->safe_seq_valid = 0;
+}
+
+// Reap the threads of dead processes (shared mode only): their allocation
+// in the scope goes back to available[] and their pending request is
+// withdrawn if they wait on a list inside the scope. The global scope also
+// drops their claims and disconnects them; until then a thread can be
+// reaped again, one scope at a time. Must be called with the scope locked.
+// Returns the number of dead threads found.
+static int reap_locked(struct scope *sc) {
+    if (shared_role == SHARED_NONE)
+        return 0;
+
+    int reaped = 0;
+    for (int t = 0; t < num_threads; t++) {
+        if (!owner_dead(t))
+            continue;
+        reaped++;
+        int listed = wait_shard[t] < 0 ? scope_is_global(sc)
+                                       : wait_shard[t] >= sc->first && wait_shard[t] <= sc->last;
+        if (waiting[t] && listed) {
+            remove_waiter(t);
+            if (stats_enabled)
+                blocked_since[t] = 0;
+        }
+        if (!waiting[t])
+            withdraw(sc, t);
+        // Dense, in case t died between updating its row and its bitmap
+        for (int i = sc->c0; i < sc->c1; i++) {
+            if (ROW(allocated, t)[i] != 0 && ctl->wfg_active)
+                holder[i] = -1;
+        }
+        reman_vec_add(available + sc->c0, ROW(allocated, t) + sc->c0, sc->c1 - sc->c0);
+        memset(ROW(allocated, t) + sc->c0, 0, (size_t)(sc->c1 - sc->c0) * sizeof(int));
+        nz_clear(sc, ROW_NZ(alloc_nz, t));
+
+        if (scope_is_global(sc) && !waiting[t]) {
+            // Fewer claims only make states safer, cached sequences stay valid
+            memset(ROW(max_claim, t), 0, (size_t)num_resources * sizeof(int));
+            nz_clear(sc, ROW_NZ(claim_nz, t));
+            __atomic_store_n(&ctl->cross_claims, ctl->cross_claims - (claim_shard[t] == -2),
+                             __ATOMIC_RELAXED);
+            claim_shard[t] = -1;
+            thread_status[t] = 0;
+            owner_pid[t] = 0;
+            park_init(t); // Every unparker holds a shard lock
+        }
+    }
+    if (reaped > 0)
+        wake_waiters(sc); // What the dead held may unblock others
+    return reaped;
+}
+
+static int detect_pass();
+static int wait_locked(struct scope *sc, int tid, int wait_ms);
+
+// Grant the pending request of tid, or block until a releasing thread
+// grants it. wait_ms bounds the wait: -1 waits for as long as it takes, 0
+// does not block at all. Must be called with the scope locked; returns with
+// it locked. Returns 0 once granted, REMAN_TIMEDOUT if the request was
+// withdrawn at the deadline, or REMAN_PREEMPTED if deadlock recovery chose
+// tid as its victim and withdrew the request.
+static int acquire_locked(struct scope *sc, int tid, int wait_ms) {
+    preempted[tid] = 0;
+    if (!must_defer(sc, tid) && can_grant(sc, tid)) {
+        grant(sc, tid);
+        return 0;
+    }
+    // The shortfall may be held by a process that crashed
+    if (reap_locked(sc) > 0 && !must_defer(sc, tid) && can_grant(sc, tid)) {
+        grant(sc, tid);
+        return 0;
+    }
+    if (wait_ms == 0) {
+        withdraw(sc, tid);
+        return REMAN_TIMEDOUT;
+    }
+
+    // Block on our own condition variable; a releasing thread grants
+    // the request on our behalf and clears waiting[tid]
+    add_waiter(sc, tid);
+    if (stats_enabled) {
+        blocked_since[tid] = stats_now();
+    }
+    return wait_locked(sc, tid, wait_ms);
+}
+
+// Wait for tid's request, which has just been put on the waiter list, to
+// be granted, withdrawn at the deadline or preempted. Results and locking
+// as for acquire_locked.
+static int wait_locked(struct scope *sc, int tid, int wait_ms) {
+    struct timespec deadline;
+    if (wait_ms > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += wait_ms / 1000;
+        deadline.tv_nsec += (long)(wait_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    TRACE(tid, REMAN_TRACE_BLOCK, tid, ROW(requested, tid), 0);
+    if (stats_enabled) {
+        STAT(blocks);
+    }
+
+    // A cycle found in the scope is always real, but one can only leave it
+    // through a claim spanning shards, and only a pass over every shard
+    // sees those or may preempt a thread waiting on several
+    int conclusive = ctl->wfg_active && (scope_is_global(sc) || ctl->cross_claims == 0);
+    int victim = ctl->wfg_active && waiting[tid] ? wfg_cycle(sc, tid) : -1;
+    int detect_now = 0; // Run a detection pass before parking
+    if (!waiting[tid]) {
+        // Granted or preempted since a combiner queued the request
+    } else if (conclusive) {
+        // Report and break the deadlock right away. A request for several
+        // resources can close more than one cycle, all through tid, so
+        // look again until none is left or tid is no longer blocked.
+        while (victim >= 0) {
+            TRACE(tid, REMAN_TRACE_DETECT, -1, NULL, 1);
+            preempt(sc, tid, victim);
+            wake_waiters(sc);
+            victim = waiting[tid] ? wfg_cycle(sc, tid) : -1;
+        }
+    } else if (victim >= 0) {
+        detect_now = 1; // Escalate to the global scope right away
+    } else if (detector_running) {
+        // Blocked waiters exist: let the detector look right away
+        pthread_mutex_lock(&detect_wait_lock);
+        detect_pending = 1;
+        pthread_cond_signal(&detect_cond);
+        pthread_mutex_unlock(&detect_wait_lock);
+    } else if (detection_mode()) {
+        detect_now = 1; // Nobody else will, and this block may close a cycle
+    }
+    int timed_out = 0;
+    for (;;) {
+        scope_unlock(sc);
+        if (detect_now) {
+            // Takes the detection lock and then every shard lock itself;
+            // a grant or preemption shows in waiting[tid] below
+            detect_now = 0;
+            detect_pass();
+        } else if (wait_ms > 0) {
+            timed_out = park_until(tid, &deadline) == ETIMEDOUT;
+        } else {
+            park(tid);
+        }
+        scope_lock(sc);
+        if (!waiting[tid]) {
+            break; // Granted on our behalf, or preempted
+        }
+        if (wait_shard[tid] < 0 && !must_defer(sc, tid) && can_grant(sc, tid)) {
+            // Poked cross-shard waiter: we hold every lock, take it ourselves
+            remove_waiter(tid);
+            stats_wait(sc, tid);
+            grant(sc, tid);
+            break;
+        }
+        if (timed_out) {
+            // Still waiting at the deadline: give up on the request
+            int reserving = tid == (wait_shard[tid] < 0 ? ctl->cross_reserved : shards[wait_shard[tid]].st->reserved);
+            remove_waiter(tid);
+            withdraw(sc, tid);
+            if (reserving) {
+                wake_waiters(sc); // What was kept for us can go to others
+            }
+            if (stats_enabled) {
+                blocked_since[tid] = 0;
+            }
+            return REMAN_TIMEDOUT;
+        }
+    }
+    if (stats_enabled) {
+        blocked_since[tid] = 0; // Preempted waits stay out of the histogram
+    }
+    if (preempted[tid]) {
+        return REMAN_PREEMPTED;
+    }
+    TRACE(tid, REMAN_TRACE_GRANT, tid, NULL, 0);
+    return 0;
+}
+
+// Detector thread body: runs a detection pass every detect_period_ms, or
+// as soon as a request blocks.
+static void *detector_main(void *arg) {
+    (void)arg;
+    if (stats_enabled)
+        my_stats = &stats_slots[STATS_MANAGER];
+    pthread_mutex_lock(&detect_wait_lock);
+    while (detector_running) {
+        if (!detect_pending) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += detect_period_ms / 1000;
+            deadline.tv_nsec += (long)(detect_period_ms % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&detect_cond, &detect_wait_lock, &deadline);
+        }
+        if (!detector_running) {
+            break;
+        }
+        detect_pending = 0;
+        pthread_mutex_unlock(&detect_wait_lock);
+        detect_pass();
+        pthread_mutex_lock(&detect_wait_lock);
+    }
+    pthread_mutex_unlock(&detect_wait_lock);
+    return NULL;
+}
+
+static int start_detector() {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&detect_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    detector_running = 1;
+    if (pthread_create(&detector_thread, NULL, detector_main, NULL) != 0) {
+        detector_running = 0;
+        pthread_cond_destroy(&detect_cond);
+        return -1;
+    }
+    return 0;
+}
+
+static void stop_detector() {
+    if (!detector_running) {
+        return;
+    }
+    pthread_mutex_lock(&detect_wait_lock);
+    detector_running = 0;
+    pthread_cond_signal(&detect_cond);
+    pthread_mutex_unlock(&detect_wait_lock);
+    pthread_join(detector_thread, NULL);
+    pthread_cond_destroy(&detect_cond);
+}
+
+// Whether t holds nothing in any shard. Only t's own requests add to its
+// allocation, so this stays true while t waits.
+static int holds_nothing(int t) {
+    struct scope all;
+    scope_global(&all);
+    return nz_empty(&all, ROW_NZ(alloc_nz, t));
+}
+
+static int rank_cmp(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    if (rank_key[x] != rank_key[y])
+        return rank_key[x] < rank_key[y] ? -1 : 1;
+    return ticket[x] < ticket[y] ? -1 : ticket[x] > ticket[y];
+}
+
+// Set the grant_policy ranking key of tid's pending request in scope own,
+// which has been passed over for steps aging periods
+static void rank_request(struct scope *own, int tid, long steps) {
+    if (ctl->grant_policy == REMAN_GRANT_PRIORITY) {
+        rank_key[tid] = -((long)priority[tid] + steps);
+    } else if (ctl->grant_policy == REMAN_GRANT_SHORTEST) {
+        long units = 0;
+        int i;
+        FOR_EACH_NZ(own, ROW_NZ(req_nz, tid), i) {
+            units += ROW(requested, tid)[i];
+        }
+        rank_key[tid] = units - steps;
+    } else {
+        rank_key[tid] = 0; // Ticket order
+    }
+}
+
+// Rank the waiters of a list, checked in scope own, and grant them in order
+// wherever they fit. *reserved is the list's reservation.
+static void wake_list(struct scope *own, uint64_t list[], int *reserved) {
+    int *order = own->sh->order;
+    int count = 0;
+    long now = scope_grants(own);
+
+    int tid;
+    FOR_EACH_TID(list, tid) {
+        rank_request(own, tid, (now - since[tid]) / AGING_GRANTS);
+        order[count++] = tid;
+    }
+    qsort(order, count, sizeof(int), rank_cmp);
+
+    *reserved = -1;
+    for (int k = 0; k < count; k++) {
+        tid = order[k];
+        if (*reserved >= 0 && holds_nothing(tid)) {
+            continue; // Holds nothing: waits behind the reservation
+        }
+        if (can_grant(own, tid)) {
+            remove_waiter(tid);
+            stats_wait(own, tid);
+            grant(own, tid);
+            unpark(tid);
+        } else if (*reserved < 0 && now - since[tid] >= STARVE_GRANTS) {
+            *reserved = tid; // Starving: keep what frees up for it
+        }
+    }
+}
+
+// Grant the waiters on one shard whose pending request fits now. sc is the
+// scope the caller holds; waiters are checked in their own shard's scope
+// unless cross-shard claims force the global one.
+static void wake_shard(struct scope *sc, int s) {
+    struct scope own;
+    if (scope_is_global(sc) && !(deadlock_avoidance && ctl->cross_claims > 0))
+        scope_single(&own, s);
+    else
+        own = *sc;
+
+    wake_list(&own, shards[s].waiters, &shards[s].st->reserved);
+}
+
+// Whether tid must queue behind another waiter's reservation in the scope
+static int must_defer(struct scope *sc, int tid) {
+    int reserved = scope_is_global(sc) && ctl->cross_reserved >= 0 && ctl->cross_reserved != tid;
+    for (int s = sc->first; s <= sc->last && !reserved; s++) {
+        reserved = shards[s].st->reserved >= 0 && shards[s].st->reserved != tid;
+    }
+    return reserved && holds_nothing(tid);
+}
+
+// Grant and wake the blocked threads whose pending request fits now, in
+// grant_policy order. Must be called with the scope locked.
+static void wake_waiters(struct scope *sc) {
+    if (sc->first == sc->last && num_shards > 1) {
+        wake_shard(sc, sc->first);
+        if (ctl->ncross == 0)
+            return;
+        // Cross-shard waiters need every lock to be granted; poke those
+        // whose slice of this shard now fits so they re-check themselves
+        int tid;
+        FOR_EACH_TID(cross_waiters, tid) {
+            if (!nz_empty(sc, ROW_NZ(req_nz, tid)) && request_fits(sc, tid, available))
+                unpark(tid);
+        }
+        return;
+    }
+
+    for (int s = 0; s < num_shards; s++) {
+        wake_shard(sc, s);
+    }
+    if (ctl->ncross > 0)
+        wake_list(sc, cross_waiters, &ctl->cross_reserved);
+}
+
+
+
+// Reserve size bytes at the next cache-line boundary of the arena layout
+static size_t carve(size_t *offset, size_t size) {
+    size_t at = (*offset + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+    *offset = at + size;
+    return at;
+}
+
+// Point ptr at the next size bytes of the arena, if it is being bound
+#define PLACE(ptr, size)                                                       \
+    do {                                                                       \
+        size_t at_ = carve(&off, size);                                        \
+        if (base != NULL)                                                      \
+            (ptr) = (void *)(base + at_);                                      \
+    } while (0)
+
+// Lay out every array in one contiguous block for the current geometry and
+// return its size. With base set, also point the globals and the
+// process-local shards[] into the arena at base. A process attaching to a
+// shared arena rebuilds the same layout from the geometry in ctl.
+static size_t layout(char *base) {
+    int holders = num_shards > 1 ? num_shards + 1 : 1;
+    size_t row = (size_t)row_stride * sizeof(int);
+    size_t matrix = (size_t)num_threads * row;
+    size_t bitmap = (size_t)num_threads * nz_stride * sizeof(uint64_t);
+    size_t per_thread = (size_t)num_threads * sizeof(int);
+    size_t per_thread_long = (size_t)num_threads * sizeof(long);
+    size_t tid_bitmap = (size_t)tid_words * sizeof(uint64_t);
+    struct shard_state *states = NULL;
+    size_t off = 0;
+
+    PLACE(ctl, sizeof(struct control));
+    PLACE(states, (size_t)holders * sizeof(struct shard_state));
+    PLACE(capacity, row);
+    PLACE(available, row);
+    PLACE(allocated, matrix);
+    PLACE(requested, matrix);
+    PLACE(max_claim, matrix);
+    PLACE(alloc_nz, bitmap);
+    PLACE(req_nz, bitmap);
+    PLACE(claim_nz, bitmap);
+    PLACE(park_lock, (size_t)num_threads * sizeof(pthread_mutex_t));
+    PLACE(cond, (size_t)num_threads * sizeof(pthread_cond_t));
+    PLACE(park_token, per_thread);
+    PLACE(thread_status, per_thread);
+    PLACE(owner_pid, (size_t)num_threads * sizeof(pid_t));
+    PLACE(waiting, per_thread);
+    PLACE(wait_shard, per_thread);
+    PLACE(claim_shard, per_thread);
+    PLACE(holder, row);
+    PLACE(priority, per_thread);
+    PLACE(birth, per_thread);
+    PLACE(preempt_count, per_thread);
+    PLACE(preempted, per_thread);
+    PLACE(ticket, per_thread_long);
+    PLACE(since, per_thread_long);
+    PLACE(rank_key, per_thread_long);
+    // Metrics only when asked for
+    PLACE(stats_slots, stats_enabled ? (size_t)(num_threads + 1) * sizeof(struct stats_slot) : 0);
+    PLACE(wait_hist, stats_enabled ? (size_t)num_resources * REMAN_STATS_BUCKETS * sizeof(uint64_t) : 0);
+    PLACE(blocked_since, stats_enabled ? (size_t)num_threads * sizeof(uint64_t) : 0);
+    PLACE(cross_waiters, tid_bitmap);
+    PLACE(combine_slots, combining ? (size_t)num_threads * sizeof(struct combine_slot) : 0);
+    // Per-shard lists, caches and scratch
+    for (int s = 0; s < holders; s++) {
+        if (base != NULL)
+            shards[s].st = &states[s];
+        PLACE(shards[s].waiters, tid_bitmap);
+        PLACE(shards[s].safe_seq, per_thread);
+        PLACE(shards[s].safe_pos, per_thread);
+        PLACE(shards[s].work_row, row);
+        PLACE(shards[s].prefix_work, row);
+        PLACE(shards[s].work_bits, (size_t)nz_stride * sizeof(uint64_t));
+        PLACE(shards[s].prefix_bits, (size_t)nz_stride * sizeof(uint64_t));
+        PLACE(shards[s].batch_held, row);
+        PLACE(shards[s].finish, per_thread);
+        PLACE(shards[s].seq, per_thread);
+        PLACE(shards[s].parent, per_thread);
+        PLACE(shards[s].order, per_thread);
+        PLACE(shards[s].published, tid_bitmap);
+        PLACE(shards[s].drained, tid_bitmap);
+    }
+    if (base != NULL)
+        global_shard = &shards[holders - 1];
+    return carve(&off, 0);
+}
+
+// Set the geometry globals and allocate the process-local shards[]
+static int set_geometry(int t_count, int r_count, int avoid, int groups) {
+    num_threads = t_count;
+    num_resources = r_count;
+    deadlock_avoidance = avoid == REMAN_AVOID;
+    ordered_acquisition = avoid == REMAN_ORDERED;
+    num_shards = groups;
+    row_stride = REMAN_FIXED_STRIDE(r_count);
+    nz_words = (r_count + 63) / 64;
+    nz_stride = (nz_words + 7) / 8 * 8;
+    tid_words = (t_count + 63) / 64;
+    fixed_active = fixed_kernels != NULL && fixed_kernels->t_count == t_count &&
+                   fixed_kernels->r_count == r_count && fixed_kernels->stride == row_stride;
+    shards = calloc(groups > 1 ? groups + 1 : 1, sizeof(struct shard)); // Plus the global scope's
+    return shards != NULL ? 0 : -1;
+}
+
+// Create the named shared memory segment for an arena of size bytes
+static void *shared_create(const char *name, size_t size) {
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return NULL;
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0) // Zero filled
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+    return map;
+}
+
+int reman_init(int t_count, int r_count, int avoid) {
+    if (t_count <= 0 || r_count <= 0 || avoid < REMAN_DETECT || avoid > REMAN_ORDERED)
+        return -1;
+    if (arena != NULL)
+        return -1; // reman_destroy the current manager first
+
+    int groups = group_sizes != NULL ? group_count : 1;
+    int holders = groups > 1 ? groups + 1 : 1; // Plus the global scope's
+    if (group_sizes != NULL) {
+        int total = 0;
+        for (int g = 0; g < group_count; g++) {
+            total += group_sizes[g];
+        }
+        if (total != r_count)
+            return -1; // Groups must partition the resources
+    }
+
+    reman_vec_init();
+    if (set_geometry(t_count, r_count, avoid, groups) != 0)
+        return -1;
+    stats_enabled = stats_requested;
+    combining = combine_requested && shared_name == NULL;
+
+    // Allocate the arena once, in shared memory if asked to
+    arena_size = layout(NULL);
+    if (shared_name != NULL) {
+        // The caller may change or free the name before reman_destroy
+        segment_name = strdup(shared_name);
+        arena = segment_name != NULL ? shared_create(segment_name, arena_size) : NULL;
+        shared_role = arena != NULL ? SHARED_CREATOR : SHARED_NONE;
+    } else if (posix_memalign(&arena, CACHE_LINE, arena_size) == 0) {
+        memset(arena, 0, arena_size);
+    } else {
+        arena = NULL;
+    }
+    if (arena == NULL) {
+        free(segment_name);
+        segment_name = NULL;
+        free(shards);
+        shards = NULL;
+        stats_enabled = 0;
+        return -1;
+    }
+    layout(arena);
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
+    lock_attrs(&mutex_attr, &cond_attr);
+
+    int lo = 0;
+    for (int s = 0; s < holders; s++) {
+        struct shard_state *st = shards[s].st;
+        st->reserved = -1;
+        if (s == groups) {
+            st->hi = r_count; // Global scope holder, never locked
+        } else {
+            st->lo = lo;
+            st->hi = lo + (group_sizes != NULL ? group_sizes[s] : r_count);
+            lo = st->hi;
+            pthread_mutex_init(&st->lock, &mutex_attr);
+        }
+        shards[s].lo = st->lo;
+        shards[s].hi = st->hi;
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        park_init(i);
+        claim_shard[i] = -1;
+    }
+    pthread_mutex_init(&ctl->detect_lock, &mutex_attr);
+    pthread_condattr_destroy(&cond_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    // Single-instance resources unless reman_set_capacity says otherwise
+    for (int i = 0; i < num_resources; i++) {
+        capacity[i] = 1;
+        available[i] = 1;
+        holder[i] = -1;
+    }
+    ctl->cross_reserved = -1;
+    ctl->wfg_active = detection_mode();
+    ctl->unit_rows = 1;
+    ctl->victim_policy = victim_policy;
+    ctl->grant_policy = grant_policy;
+    ctl->arena_size = arena_size;
+    ctl->t_count = t_count;
+    ctl->r_count = r_count;
+    ctl->avoid = avoid;
+    ctl->groups = groups;
+    ctl->stats = stats_enabled;
+    __atomic_store_n(&ctl->magic, CONTROL_MAGIC, __ATOMIC_RELEASE); // Open for attaching
+
+    // From here on, failing means taking down what is already set up
+    if (trace_capacity > 0) {
+        if (reman_trace_init(num_threads + 1, trace_capacity) != 0) {
+            reman_destroy();
+            return -1;
+        }
+        tracing = 1;
+    }
+
+    // In detection mode, deadlocks are found off the request path
+    if (detection_mode() && detect_period_ms > 0) {
+        if (start_detector() != 0) {
+            reman_destroy();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int reman_set_shared(const char *name) {
+    shared_name = name;
+    return 0;
+}
+
+int reman_attach(const char *name) {
+    if (arena != NULL)
+        return -1; // This process already has a manager
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return -1;
+    struct stat sb;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &sb) == 0 && (size_t)sb.st_size >= sizeof(struct control))
+        map = mmap(NULL, (size_t)sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    struct control *c = map;
+    if (__atomic_load_n(&c->magic, __ATOMIC_ACQUIRE) != CONTROL_MAGIC ||
+        c->arena_size != (size_t)sb.st_size) {
+        munmap(map, (size_t)sb.st_size);
+        return -1; // Not a manager arena, or its creator is not done yet
+    }
+
+    reman_vec_init();
+    if (set_geometry(c->t_count, c->r_count, c->avoid, c->groups) != 0) {
+        munmap(map, (size_t)sb.st_size);
+        return -1;
+    }
+    stats_enabled = c->stats;
+    combining = 0;
+    arena = map;
+    arena_size = (size_t)sb.st_size;
+    shared_role = SHARED_ATTACHED;
+    layout(arena);
+    for (int s = 0; s <= global_shard - shards; s++) {
+        shards[s].lo = shards[s].st->lo;
+        shards[s].hi = shards[s].st->hi;
+    }
+
+    // Tracing is per process; the detector runs in the creator
+    if (trace_capacity > 0) {
+        if (reman_trace_init(num_threads + 1, trace_capacity) != 0) {
+            reman_destroy(); // Only detaches
+            return -1;
+        }
+        tracing = 1;
+    }
+    return 0;
+}
+
+int reman_set_groups(int count, int sizes[]) {
+    if (count < 0)
+        return -1;
+    for (int g = 0; g < count; g++) {
+        if (sizes[g] <= 0)
+            return -1;
+    }
+
+    free(group_sizes);
+    group_sizes = NULL;
+    group_count = 0;
+    if (count <= 1)
+        return 0; // One group is the default
+
+    group_sizes = malloc((size_t)count * sizeof(int));
+    if (group_sizes == NULL)
+        return -1;
+    memcpy(group_sizes, sizes, (size_t)count * sizeof(int));
+    group_count = count;
+    return 0;
+}
+
+int reman_set_capacity(int count[]) {
+    if (ctl == NULL)
+        return -1; // Only between reman_init and reman_destroy
+    struct scope sc;
+    scope_global(&sc);
+    scope_lock(&sc);
+    // Units already handed out stay allocated; only the free part changes
+    for (int i = 0; i < num_resources; i++) {
+        if (count[i] < capacity[i] - available[i]) {
+            scope_unlock(&sc);
+            return -1; // Fewer instances than are allocated right now
+        }
+    }
     for (int tid = 0; tid < num_threads; tid++) {
-        if (!finish[tid]) {
-            return 0; // Unsafe state
+        if (!reman_vec_le(ROW(max_claim, tid), count, num_resources)) {
+            scope_unlock(&sc);
+            return -1; // Would leave an existing claim unsatisfiable
         }
     }
+    int single = 1;
+    for (int i = 0; i < num_resources; i++) {
+        available[i] += count[i] - capacity[i];
+        capacity[i] = count[i];
+        single &= count[i] == 1;
+    }
+    if (detection_mode() && single && !ctl->wfg_active) {
+        // Back to single instances: rebuild the holders from the allocations
+        for (int i = 0; i < num_resources; i++) {
+            holder[i] = -1;
+        }
+        for (int tid = 0; tid < num_threads; tid++) {
+            int i;
+            FOR_EACH_NZ(&sc, ROW_NZ(alloc_nz, tid), i) {
+                holder[i] = tid;
+            }
+        }
+    }
+    ctl->wfg_active = detection_mode() && single;
+    ctl->unit_rows = single;
+    for (int s = 0; s < num_shards; s++) {
+        shards[s].st->safe_seq_valid = 0; // Fewer free units may break the cached order
+    }
+    global_shard->st->safe_seq_valid = 0;
+    wake_waiters(&sc);     // More free units may unblock waiters
+    scope_unlock(&sc);
+    return 0;
+}
+
+int reman_set_fixed(const struct reman_fixed *kernels) {
+    if (kernels != NULL && kernels->stride != REMAN_FIXED_STRIDE(kernels->r_count))
+        return -1; // Built against another row layout
+    fixed_kernels = kernels;
+    return 0;
+}
+
+int reman_set_detect_period(int msec) {
+    if (msec < 0)
+        return -1;
+    detect_period_ms = msec;
+    return 0;
+}
+
+int reman_set_victim_policy(int policy) {
+    if (policy < REMAN_VICTIM_FIRST || policy > REMAN_VICTIM_MIN)
+        return -1;
+    victim_policy = policy;
+    if (ctl != NULL)
+        ctl->victim_policy = policy;
+    return 0;
+}
+
+int reman_set_grant_policy(int policy) {
+    if (policy < REMAN_GRANT_FIFO || policy > REMAN_GRANT_SHORTEST)
+        return -1;
+    grant_policy = policy;
+    if (ctl != NULL)
+        ctl->grant_policy = policy;
+    return 0;
+}
+
+int reman_set_priority(int prio) {
+    int tid = find_tid();
+    if (tid == -1) {
+        return -1;
+    }
+
+    struct scope sc;
+    scope_global(&sc);
+    scope_lock(&sc);
+    priority[tid] = prio;
+    scope_unlock(&sc);
+    return 0;
+}
 
-    return 1; // Safe state
+int reman_set_trace(int capacity, const char *dump_path) {
+    if (capacity < 0)
+        return -1;
+    trace_capacity = capacity;
+    trace_path = dump_path;
+    return 0;
 }
 
+int reman_trace_read(struct reman_trace_rec out[], int max) {
+    if (!tracing)
+        return 0;
+    return reman_trace_drain(out, max);
+}
 
+int reman_set_stats(int enable) {
+    stats_requested = enable != 0;
+    return 0;
+}
 
-int reman_init(int t_count, int r_count, int avoid) {
-    if (t_count > MAXT || r_count > MAXR)
+int reman_set_combining(int enable) {
+    combine_requested = enable != 0;
+    return 0;
+}
+
+int reman_stats(struct reman_stats *out) {
+    if (!stats_enabled)
         return -1;
 
-    num_threads = t_count;
-    num_resources = r_count;
-    deadlock_avoidance = avoid;
+    // Merge the slots; each field is read once, so concurrent updates show
+    // up either in this read or the next
+    memset(out, 0, sizeof(*out));
+    for (int t = 0; t <= num_threads; t++) {
+        struct stats_slot *slot = &stats_slots[t];
+        out->requests += __atomic_load_n(&slot->requests, __ATOMIC_RELAXED);
+        out->grants += __atomic_load_n(&slot->grants, __ATOMIC_RELAXED);
+        out->denies += __atomic_load_n(&slot->denies, __ATOMIC_RELAXED);
+        out->blocks += __atomic_load_n(&slot->blocks, __ATOMIC_RELAXED);
+        out->preemptions += __atomic_load_n(&slot->preemptions, __ATOMIC_RELAXED);
+        out->timeouts += __atomic_load_n(&slot->timeouts, __ATOMIC_RELAXED);
+        out->releases += __atomic_load_n(&slot->releases, __ATOMIC_RELAXED);
+        out->fast_path += __atomic_load_n(&slot->fast_path, __ATOMIC_RELAXED);
+        out->combined += __atomic_load_n(&slot->combined, __ATOMIC_RELAXED);
+        out->lock_acquires += __atomic_load_n(&slot->lock_acquires, __ATOMIC_RELAXED);
+        out->lock_wait_ns += __atomic_load_n(&slot->lock_wait_ns, __ATOMIC_RELAXED);
+        out->lock_hold_ns += __atomic_load_n(&slot->lock_hold_ns, __ATOMIC_RELAXED);
+        out->safety_checks += __atomic_load_n(&slot->safety_checks, __ATOMIC_RELAXED);
+        out->safety_ns += __atomic_load_n(&slot->safety_ns, __ATOMIC_RELAXED);
+        out->detections += __atomic_load_n(&slot->detections, __ATOMIC_RELAXED);
+        out->detect_ns += __atomic_load_n(&slot->detect_ns, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
 
-    pthread_mutex_init(&lock, NULL);
-    for (int i = 0; i < num_threads; i++) {
-        pthread_cond_init(&cond[i], NULL);
+int reman_stats_wait_hist(int resource, uint64_t hist[REMAN_STATS_BUCKETS]) {
+    if (!stats_enabled || resource < 0 || resource >= num_resources)
+        return -1;
+    for (int b = 0; b < REMAN_STATS_BUCKETS; b++) {
+        hist[b] = __atomic_load_n(&wait_hist[(size_t)resource * REMAN_STATS_BUCKETS + b], __ATOMIC_RELAXED);
     }
+    return 0;
+}
 
-    for (int i = 0; i < num_resources; i++) {
-        available[i] = 1;
+int reman_destroy() {
+    if (ctl == NULL)
+        return -1; // Never set up, or already destroyed
+    stop_detector();
+    stats_enabled = 0;
+
+    if (tracing) {
+        // Drain whatever the reader has not collected yet
+        FILE *out = trace_path != NULL ? fopen(trace_path, "w") : NULL;
+        if (out != NULL) {
+            reman_trace_dump(out);
+            fclose(out);
+        }
+        tracing = 0;
+        reman_trace_free();
     }
 
-    for (int i = 0; i < num_threads; i++) {
-        for (int j = 0; j < num_resources; j++) {
-            allocated[i][j] = 0;
-            requested[i][j] = 0;
-            max_claim[i][j] = 0;
+    if (shared_role == SHARED_CREATOR) {
+        // Waiters of dead processes would keep their conds from going away
+        struct scope sc;
+        scope_global(&sc);
+        scope_lock(&sc);
+        reap_locked(&sc);
+        scope_unlock(&sc);
+    }
+    if (shared_role != SHARED_ATTACHED) {
+        for (int s = 0; s < num_shards; s++) {
+            pthread_mutex_destroy(&shards[s].st->lock);
         }
+        for (int i = 0; i < num_threads; i++) {
+            pthread_mutex_destroy(&park_lock[i]);
+            pthread_cond_destroy(&cond[i]);
+        }
+        pthread_mutex_destroy(&ctl->detect_lock);
+    }
+    if (shared_role == SHARED_NONE) {
+        free(arena);
+    } else {
+        // Only the creator removes the segment; attached processes detach
+        munmap(arena, arena_size);
+        if (shared_role == SHARED_CREATOR)
+            shm_unlink(segment_name);
     }
-   
+    free(segment_name);
+    segment_name = NULL;
+    arena = NULL;
+    ctl = NULL;
+    shared_role = SHARED_NONE;
+    free(shards);
+    shards = NULL;
+    manager_generation++;
     return 0;
 }
 
 int reman_connect(int tid) {
-    if (tid < 0 || tid >= num_threads)
+    if (ctl == NULL || tid < 0 || tid >= num_threads)
         return -1;
 
-    pthread_mutex_lock(&lock);
-    thread_ids[tid] = pthread_self();
+    struct scope sc;
+    scope_global(&sc);
+    scope_lock(&sc);
+    reap_locked(&sc); // A tid of a crashed process may be taken over
+    my_tid = tid;
+    my_generation = manager_generation;
+    my_stats = stats_enabled ? &stats_slots[tid] : NULL;
     thread_status[tid] = 1;
-    pthread_mutex_unlock(&lock);
+    owner_pid[tid] = getpid();
+    birth[tid] = ++ctl->birth_clock;
+    scope_unlock(&sc);
+    TRACE(tid, REMAN_TRACE_CONNECT, tid, NULL, 0);
     return 0;
 }
 
 int reman_disconnect() {
-    pthread_mutex_lock(&lock);
     int tid = find_tid();
     if (tid == -1) {
-        pthread_mutex_unlock(&lock);
         return -1;
     }
+
+    struct scope sc;
+    scope_global(&sc);
+    scope_lock(&sc);
     thread_status[tid] = 0;
-    pthread_mutex_unlock(&lock);
+    owner_pid[tid] = 0;
+    my_tid = -1;
+    my_stats = NULL;
+    scope_unlock(&sc);
+    TRACE(tid, REMAN_TRACE_DISCONNECT, tid, NULL, 0);
     return 0;
 }
 
+// Track claims that span shards; they switch avoidance to the global scope.
+// Must be called with every shard locked.
+static void track_claim(struct scope *sc, int tid) {
+    int s = vector_shard(ROW(max_claim, tid));
+    if (s >= 0 && nz_empty(sc, ROW_NZ(claim_nz, tid)))
+        s = -1;
+    else if (s < 0)
+        s = -2;
+    int cross = ctl->cross_claims + (s == -2) - (claim_shard[tid] == -2);
+    __atomic_store_n(&ctl->cross_claims, cross, __ATOMIC_RELAXED);
+    claim_shard[tid] = s;
+}
+
 int reman_claim(int claim[]) {
-    pthread_mutex_lock(&lock);
     int tid = find_tid();
     if (tid == -1) {
-        pthread_mutex_unlock(&lock);
         return -1;
     }
-    for (int i = 0; i < num_resources; i++) {
-        max_claim[tid][i] = claim[i];
+
+    struct scope sc;
+    scope_global(&sc);
+    scope_lock(&sc);
+    if (!reman_vec_le(claim, capacity, num_resources)) {
+        scope_unlock(&sc);
+        return -1; // Cannot claim more instances than exist
+    }
+    memcpy(ROW(max_claim, tid), claim, (size_t)num_resources * sizeof(int));
+    reman_vec_nz_mask(claim, num_resources, ROW_NZ(claim_nz, tid));
+
+    track_claim(&sc, tid);
+
+    for (int g = 0; g < num_shards; g++) {
+        shards[g].st->safe_seq_valid = 0; // New need vector, cached safe sequence is stale
     }
-    pthread_mutex_unlock(&lock);
+    global_shard->st->safe_seq_valid = 0;
+    scope_unlock(&sc);
+    TRACE(tid, REMAN_TRACE_CLAIM, tid, claim, 0);
     return 0;
 }
 
-int reman_request(int request[]) {
-    pthread_mutex_lock(&lock);
-    int tid = find_tid();
-    if (tid == -1) {
-        pthread_mutex_unlock(&lock);
-        return -1; // Invalid thread ID
+// Highest resource index tid holds, -1 if none. Apart from preemption and
+// reaping, which ordered mode never needs, only tid's own operations change
+// its allocation, so tid may read it without the lock.
+static int top_held(int tid) {
+    uint64_t *mask = ROW_NZ(alloc_nz, tid);
+    for (int w = nz_words - 1; w >= 0; w--) {
+        uint64_t bits = NZ_WORD(mask, w);
+        if (bits != 0)
+            return w * 64 + 63 - __builtin_clzll(bits);
     }
+    return -1;
+}
 
+// Ordered acquisition: whether request[] asks only for resources above
+// every one tid holds. Then every thread waits only on threads holding
+// higher indices than it does, which cannot close a cycle.
+static int in_order(int tid, const int request[]) {
+    int top = top_held(tid);
+    for (int i = 0; i <= top; i++) {
+        if (request[i] != 0)
+            return 0;
+    }
+    return 1;
+}
 
-    // Check if the request exceeds the thread's maximum claim
-    for (int i = 0; i < num_resources; i++) {
-        if (request[i] + allocated[tid][i] > max_claim[tid][i]) {
-            pthread_mutex_unlock(&lock);
-            return -1; // Deny request
+// The same for a batch whose replay left held[] in the scope: what it
+// still holds while its net request waits is what neither the batch
+// releases nor the scope leaves out
+static int batch_in_order(struct scope *sc, int tid, const int held[]) {
+    int *alloc = ROW(allocated, tid);
+    int top = top_held(tid);
+    if (top < sc->c1) {
+        top = -1; // Below the scope nothing can be out of order
+        for (int i = sc->c1 - 1; i >= sc->c0 && top < 0; i--) {
+            if (alloc[i] > 0 && held[i] > 0)
+                top = i;
         }
     }
+    for (int i = sc->c0; i <= top && i < sc->c1; i++) {
+        if (held[i] > alloc[i])
+            return 0;
+    }
+    return 1;
+}
 
-    // If deadlock avoidance is enabled, check for safety
-    if (deadlock_avoidance) {
-        // Temporarily allocate resources to check for safety
-        for (int i = 0; i < num_resources; i++) {
-            available[i] -= request[i];
-            allocated[tid][i] += request[i];
+// Record request[] as the pending request of tid so that release and
+// detection can see it; -1 if it exceeds the thread's maximum claim
+static int record_request(struct scope *sc, int tid, int request[]) {
+    int n = sc->c1 - sc->c0;
+    if (!reman_vec_sum_le(request + sc->c0, ROW(allocated, tid) + sc->c0, ROW(max_claim, tid) + sc->c0, n))
+        return -1;
+    memcpy(ROW(requested, tid) + sc->c0, request + sc->c0, (size_t)n * sizeof(int));
+    nz_rebuild(sc, ROW(requested, tid), ROW_NZ(req_nz, tid));
+    return 0;
+}
+
+// Return release[] from the allocation of tid without waking anyone; -1 if
+// it is more than tid holds
+static int release_locked(struct scope *sc, int tid, int release[]) {
+    int n = sc->c1 - sc->c0;
+    if (!reman_vec_le(release + sc->c0, ROW(allocated, tid) + sc->c0, n))
+        return -1;
+    reman_vec_add(available + sc->c0, release + sc->c0, n);
+    reman_vec_sub(ROW(allocated, tid) + sc->c0, release + sc->c0, n);
+    nz_rebuild(sc, ROW(allocated, tid), ROW_NZ(alloc_nz, tid));
+    if (ctl->wfg_active) {
+        for (int i = sc->c0; i < sc->c1; i++) {
+            if (release[i] != 0)
+                holder[i] = -1;
         }
+    }
+    return 0;
+}
 
-        if (!is_safe_state()) {
-            // Rollback allocation if unsafe
-            for (int i = 0; i < num_resources; i++) {
-                available[i] += request[i];
-                allocated[tid][i] -= request[i];
-            }
-            pthread_mutex_unlock(&lock);
-            return -1; // Denied due to unsafe state
+// Whether an operation on shard s still belongs to the locked scope; a
+// claim spanning shards may have moved it to the global one since
+static int combine_in_scope(struct scope *sc, int s) {
+    struct scope want;
+    scope_for(&want, s);
+    return want.first == sc->first && want.last == sc->last;
+}
+
+// Grant a recorded request that was published by tid if it can be granted
+// right now, and queue it as a waiter otherwise, like acquire_locked does
+// short of waiting
+static int combine_request(struct scope *sc, int tid, struct combine_slot *slot) {
+    preempted[tid] = 0;
+    if (!must_defer(sc, tid) && can_grant(sc, tid)) {
+        grant(sc, tid);
+        return 0;
+    }
+    if (slot->wait_ms == 0) {
+        withdraw(sc, tid);
+        return REMAN_TIMEDOUT;
+    }
+    add_waiter(sc, tid);
+    ticket[tid] = slot->ticket; // Keep its place in arrival order
+    if (stats_enabled) {
+        blocked_since[tid] = stats_now();
+    }
+    return COMBINE_QUEUED;
+}
+
+static void combine_done(struct combine_slot *slot, int result) {
+    slot->result = result;
+    __atomic_store_n(&slot->state, COMBINE_DONE, __ATOMIC_RELEASE);
+}
+
+// One combining pass over what is published for the locked scope: all the
+// releases, one wake pass, then the requests in grant_policy order. Returns
+// how many operations it handled.
+static int combine_pass(struct scope *sc) {
+    uint64_t *drained = sc->sh->drained;
+    int *order = sc->sh->order;
+    int count = 0, released = 0, nreq = 0;
+    int t;
+
+    for (int w = 0; w < tid_words; w++) {
+        drained[w] = __atomic_exchange_n(&sc->sh->published[w], 0, __ATOMIC_ACQUIRE);
+    }
+    FOR_EACH_TID(drained, t) {
+        struct combine_slot *slot = &combine_slots[t];
+        if (slot->op != REMAN_OP_RELEASE)
+            continue;
+        int result = COMBINE_SLOW;
+        if (combine_in_scope(sc, slot->shard)) {
+            result = release_locked(sc, t, slot->vector);
+            released |= result == 0;
+        }
+        // Once done the owner may publish again, so the slot is not looked at twice
+        TID_CLEAR(drained, t);
+        combine_done(slot, result);
+        count++;
+    }
+    if (released) {
+        wake_waiters(sc);
+    }
+    // Only the requests are left. Rank them all before any is done and
+    // its owner can publish again.
+    FOR_EACH_TID(drained, t) {
+        struct combine_slot *slot = &combine_slots[t];
+        slot->result = COMBINE_SLOW;
+        if (combine_in_scope(sc, slot->shard)) {
+            slot->result = record_request(sc, t, slot->vector);
+            ticket[t] = slot->ticket;
+            rank_request(sc, t, 0);
         }
+        order[nreq++] = t;
+    }
+    qsort(order, nreq, sizeof(int), rank_cmp);
+    for (int k = 0; k < nreq; k++) {
+        struct combine_slot *slot = &combine_slots[order[k]];
+        int result = slot->result;
+        if (result == 0)
+            result = combine_request(sc, order[k], slot);
+        combine_done(slot, result);
+        count++;
+    }
+    if (stats_enabled && my_stats != NULL)
+        STAT_ADD(my_stats, combined, count);
+    return count;
+}
 
-    } else {
-        // For deadlock detection mode, grant the request without checking safety
-        for (int i = 0; i < num_resources; i++) {
-            available[i] -= request[i];
-            allocated[tid][i] += request[i];
+// Publish an operation of tid on shard s and wait until a combiner for its
+// scope, possibly this very thread, has applied it. Returns the result,
+// COMBINE_SLOW when the ordinary path must handle it, or COMBINE_QUEUED
+// when the request now waits in scope *sc.
+static int combine(struct scope *sc, int tid, int op, int vector[], int s, int wait_ms) {
+    scope_for(sc, s);
+    struct shard_state *st = sc->sh->st;
+    struct combine_slot *slot = &combine_slots[tid];
+
+    slot->op = op;
+    slot->shard = s;
+    slot->wait_ms = wait_ms;
+    slot->vector = vector;
+    if (op == REMAN_OP_REQUEST)
+        slot->ticket = __atomic_add_fetch(&ctl->ticket_clock, 1, __ATOMIC_RELAXED);
+    slot->state = COMBINE_PUBLISHED;
+    __atomic_fetch_or(&sc->sh->published[tid / 64], (uint64_t)1 << (tid % 64), __ATOMIC_RELEASE);
+
+    while (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != COMBINE_DONE) {
+        if (__atomic_load_n(&st->combiner, __ATOMIC_RELAXED) == 0 &&
+            __atomic_exchange_n(&st->combiner, 1, __ATOMIC_ACQUIRE) == 0) {
+            scope_lock(sc);
+            for (int pass = 0; pass < COMBINE_PASSES && combine_pass(sc) > 0; pass++)
+                ;
+            scope_unlock(sc);
+            __atomic_store_n(&st->combiner, 0, __ATOMIC_RELEASE);
+        } else {
+            sched_yield();
         }
+    }
+    slot->state = COMBINE_IDLE;
+    return slot->result;
+}
 
+// Request for the calling thread, waiting at most wait_ms (see acquire_locked)
+static int request_wait(int request[], int wait_ms) {
+    int tid = find_tid();
+    if (tid == -1) {
+        return -1; // Invalid thread ID
     }
 
-    // Clear pending requests for the thread
-    for (int i = 0; i < num_resources; i++) {
-        requested[tid][i] = 0;
+    if (ordered_acquisition && !in_order(tid, request)) {
+        stats_count(-1);
+        TRACE(tid, REMAN_TRACE_REQUEST, tid, request, -1);
+        return -1; // Out of order, could close a cycle
     }
 
-    pthread_mutex_unlock(&lock);
+    int s = vector_shard(request);
+    if (s >= 0 && fast_enter(&shards[s])) {
+        struct shard *sh = &shards[s];
+        // Only this thread writes its own row while the gate is open
+        int *alloc = ROW(allocated, tid);
+        if (!reman_vec_sum_le(request + sh->lo, alloc + sh->lo, ROW(max_claim, tid) + sh->lo, sh->hi - sh->lo)) {
+            fast_exit(sh);
+            stats_count(-1);
+            TRACE(tid, REMAN_TRACE_REQUEST, tid, request, -1);
+            return -1; // Deny request
+        }
+        if (fast_take(sh, request)) {
+            uint64_t *alloc_mask = ROW_NZ(alloc_nz, tid);
+            reman_vec_add(alloc + sh->lo, request + sh->lo, sh->hi - sh->lo);
+            for (int i = sh->lo; i < sh->hi; i++) {
+                if (request[i] != 0) {
+                    __atomic_fetch_or(&alloc_mask[i / 64], (uint64_t)1 << (i % 64), __ATOMIC_RELAXED);
+                    if (ctl->wfg_active)
+                        holder[i] = tid; // Single instance, so it is ours alone
+                }
+            }
+            fast_exit(sh);
+            stats_count(0);
+            STAT(fast_path);
+            TRACE(tid, REMAN_TRACE_REQUEST, tid, request, 0);
+            return 0; // Granted without the lock
+        }
+        fast_exit(sh); // Short on something: queue up under the lock
+    }
 
-    // For avoid = 0, detect and resolve deadlocks after granting the request
-    if (!deadlock_avoidance) {
-        reman_detect();
+    struct scope sc;
+    if (combining) {
+        int result = combine(&sc, tid, REMAN_OP_REQUEST, request, s, wait_ms);
+        if (result == COMBINE_QUEUED) {
+            scope_lock(&sc);
+            result = wait_locked(&sc, tid, wait_ms);
+            scope_unlock(&sc);
+        }
+        if (result != COMBINE_SLOW) {
+            stats_count(result);
+            TRACE(tid, REMAN_TRACE_REQUEST, tid, request, result);
+            return result;
+        }
+    }
+
+    scope_enter(&sc, s);
+
+    if (record_request(&sc, tid, request) != 0) {
+        scope_unlock(&sc);
+        stats_count(-1);
+        TRACE(tid, REMAN_TRACE_REQUEST, tid, request, -1);
+        return -1; // Deny request
     }
 
-    return 0; // Request granted
+    int result = acquire_locked(&sc, tid, wait_ms);
+
+    scope_unlock(&sc);
+    stats_count(result);
+    TRACE(tid, REMAN_TRACE_REQUEST, tid, request, result);
+    return result; // 0 when granted
 }
 
+int reman_request(int request[]) {
+    return request_wait(request, -1);
+}
 
+int reman_tryrequest(int request[]) {
+    return request_wait(request, 0);
+}
 
+int reman_request_timed(int request[], int timeout_ms) {
+    if (timeout_ms < 0)
+        return -1;
+    return request_wait(request, timeout_ms);
+}
 
-int reman_release(int release[]) {
-    pthread_mutex_lock(&lock);
+int reman_batch(struct reman_op ops[], int count) {
     int tid = find_tid();
-    if (tid == -1) {
-        pthread_mutex_unlock(&lock);
+    if (tid == -1 || count < 0) {
         return -1; // Invalid thread ID
     }
 
-    for (int i = 0; i < num_resources; i++) {
-        printf("%d ", release[i]);
+    // One shard if every vector stays inside the same one
+    int s = count > 0 ? -2 : 0;
+    for (int k = 0; k < count && s != -1; k++) {
+        int v = vector_shard(ops[k].vector);
+        s = (s == -2 || s == v) ? v : -1;
     }
-    printf("\n");
 
-    for (int i = 0; i < num_resources; i++) {
-        if (release[i] > allocated[tid][i]) {
-            pthread_mutex_unlock(&lock);
-            return -1; // Cannot release more than allocated
+    struct scope sc;
+    scope_enter(&sc, s);
+    int c0 = sc.c0, n = sc.c1 - sc.c0;
+
+    // Replay the operations on a copy of our allocation to validate each
+    // step against what would be held at that point
+    int *alloc = ROW(allocated, tid);
+    int *held = sc.sh->batch_held;
+    memcpy(held + c0, alloc + c0, (size_t)n * sizeof(int));
+    for (int k = 0; k < count; k++) {
+        if (ops[k].type == REMAN_OP_REQUEST) {
+            reman_vec_add(held + c0, ops[k].vector + c0, n);
+            if (!reman_vec_le(held + c0, ROW(max_claim, tid) + c0, n)) {
+                scope_unlock(&sc);
+                stats_count(-1);
+                TRACE(tid, REMAN_TRACE_BATCH, tid, NULL, -1);
+                return -1; // Exceeds the maximum claim, nothing applied
+            }
+        } else if (ops[k].type == REMAN_OP_RELEASE) {
+            if (!reman_vec_le(ops[k].vector + c0, held + c0, n)) {
+                scope_unlock(&sc);
+                stats_count(-1);
+                TRACE(tid, REMAN_TRACE_BATCH, tid, NULL, -1);
+                return -1; // Releases more than held, nothing applied
+            }
+            reman_vec_sub(held + c0, ops[k].vector + c0, n);
+        } else {
+            scope_unlock(&sc);
+            return -1;
         }
-        available[i] += release[i];
-        allocated[tid][i] -= release[i];
+    }
+    if (ordered_acquisition && !batch_in_order(&sc, tid, held)) {
+        scope_unlock(&sc);
+        stats_count(-1);
+        TRACE(tid, REMAN_TRACE_BATCH, tid, NULL, -1);
+        return -1; // Net request out of order, nothing applied
     }
 
-    pthread_cond_broadcast(&cond[0]); // Notify all blocked threads
-    pthread_mutex_unlock(&lock);
-    return 0;
-}
+    // Apply the net effect: columns that shrink are released right away,
+    // columns that grow become a single pending request
+    int *req = ROW(requested, tid);
+    int released = 0;
+    for (int i = sc.c0; i < sc.c1; i++) {
+        int net = held[i] - alloc[i];
+        if (net < 0) {
+            available[i] -= net;
+            alloc[i] = held[i];
+            released = 1;
+            if (ctl->wfg_active)
+                holder[i] = -1;
+        }
+        req[i] = net > 0 ? net : 0;
+    }
+    nz_rebuild(&sc, alloc, ROW_NZ(alloc_nz, tid));
+    nz_rebuild(&sc, req, ROW_NZ(req_nz, tid));
 
+    if (released) {
+        wake_waiters(&sc);
+    }
+    int result = 0;
+    if (!nz_empty(&sc, ROW_NZ(req_nz, tid))) {
+        result = acquire_locked(&sc, tid, -1); // One safety evaluation for the whole batch
+    }
 
+    scope_unlock(&sc);
+    stats_count(result);
+    TRACE(tid, REMAN_TRACE_BATCH, tid, NULL, result);
+    return result;
+}
 
-int reman_detect() {
-    pthread_mutex_lock(&lock);
 
-    int work[MAXR];
-    int finish[MAXT] = {0};
-    int deadlock_count = 0;
 
-    // Initialize work array with available resources
-    for (int i = 0; i < num_resources; i++) {
-        work[i] = available[i];
-    }
 
+int reman_release(int release[]) {
+    int tid = find_tid();
+    if (tid == -1) {
+        return -1; // Invalid thread ID
+    }
 
-    // Mark threads with no allocated resources as "finished"
-    for (int tid = 0; tid < num_threads; tid++) {
-        int has_allocation = 0;
-        for (int i = 0; i < num_resources; i++) {
-            if (allocated[tid][i] > 0) {
-                has_allocation = 1;
-                break;
+    int s = vector_shard(release);
+    if (s >= 0 && fast_enter(&shards[s])) {
+        struct shard *sh = &shards[s];
+        struct scope own;
+        scope_single(&own, s);
+        int *alloc = ROW(allocated, tid);
+        if (!reman_vec_le(release + sh->lo, alloc + sh->lo, sh->hi - sh->lo)) {
+            fast_exit(sh);
+            TRACE(tid, REMAN_TRACE_RELEASE, tid, release, -1);
+            return -1; // Cannot release more than allocated
+        }
+        reman_vec_sub(alloc + sh->lo, release + sh->lo, sh->hi - sh->lo);
+        nz_rebuild(&own, alloc, ROW_NZ(alloc_nz, tid));
+        for (int i = sh->lo; i < sh->hi; i++) {
+            if (release[i] != 0) {
+                if (ctl->wfg_active)
+                    holder[i] = -1; // Before it becomes available to others
+                __atomic_add_fetch(&available[i], release[i], __ATOMIC_RELEASE);
             }
         }
-        if (!has_allocation) {
-            finish[tid] = 1;
+        fast_exit(sh);
+        STAT(releases);
+        STAT(fast_path);
+        TRACE(tid, REMAN_TRACE_RELEASE, tid, release, 0);
+        return 0; // Nobody is waiting, nothing to wake
+    }
+
+    struct scope sc;
+    if (combining) {
+        int result = combine(&sc, tid, REMAN_OP_RELEASE, release, s, 0);
+        if (result != COMBINE_SLOW) {
+            if (result == 0)
+                STAT(releases);
+            TRACE(tid, REMAN_TRACE_RELEASE, tid, release, result);
+            return result;
         }
     }
 
-    // Try to finish threads in a simulated environment
+    scope_enter(&sc, s);
+    if (release_locked(&sc, tid, release) != 0) {
+        scope_unlock(&sc);
+        TRACE(tid, REMAN_TRACE_RELEASE, tid, release, -1);
+        return -1; // Cannot release more than allocated
+    }
+
+    wake_waiters(&sc); // Hand freed resources to blocked threads that can use them
+    scope_unlock(&sc);
+    STAT(releases);
+    TRACE(tid, REMAN_TRACE_RELEASE, tid, release, 0);
+    return 0;
+}
+
+
+
+// Finish every thread whose pending request fits in work, returning its
+// allocation to work, until no more can. Returns how many are left.
+static int reduce(struct scope *sc, int work[], int finish[]) {
+    if (fixed_covers(sc))
+        return fixed_kernels->reduce(work, allocated, requested, finish);
+
     int found;
     do {
         found = 0;
         for (int tid = 0; tid < num_threads; tid++) {
             if (!finish[tid]) {
-                int can_finish = 1;
-                for (int i = 0; i < num_resources; i++) {
-                    if (requested[tid][i] > work[i]) {
-                        can_finish = 0;
-                        break;
-                    }
-                }
-                if (can_finish) {
+                if (request_fits(sc, tid, work)) {
                     // Pretend thread finishes and releases its resources
-                    for (int i = 0; i < num_resources; i++) {
-                        work[i] += allocated[tid][i];
-                    }
+                    add_allocation(sc, work, tid);
                     finish[tid] = 1;
                     found = 1;
                 }
@@ -290,37 +2578,275 @@ int reman_detect() {
         }
     } while (found);
 
-    // Count deadlocked threads
+    int left = 0;
     for (int tid = 0; tid < num_threads; tid++) {
         if (!finish[tid]) {
-            deadlock_count++;
+            left++;
         }
     }
+    return left;
+}
 
-    if (deadlock_count > 0) {
-        printf("Deadlock detected with %d threads.\n", deadlock_count);
-
-        // Preempt resources from the first detected deadlocked thread
+// reduce for unit rows
+static int reduce_bits(struct scope *sc, uint64_t work[], int finish[]) {
+    int found;
+    do {
+        found = 0;
         for (int tid = 0; tid < num_threads; tid++) {
-            if (!finish[tid]) {
-                for (int i = 0; i < num_resources; i++) {
-                    available[i] += allocated[tid][i];
-                    allocated[tid][i] = 0;
-                }
-                break; // Preempt one thread at a time
+            if (!finish[tid] && request_fits_bits(sc, tid, work)) {
+                add_allocation_bits(sc, work, tid);
+                finish[tid] = 1;
+                found = 1;
+            }
+        }
+    } while (found);
+
+    int left = 0;
+    for (int tid = 0; tid < num_threads; tid++) {
+        left += !finish[tid];
+    }
+    return left;
+}
+
+// Pick the deadlocked thread to preempt. For REMAN_VICTIM_MIN each
+// candidate is scored by how many threads stay deadlocked after it is
+// preempted, a greedy step towards the fewest preemptions overall.
+static int pick_victim(struct scope *sc, int work[], int finish[]) {
+    struct shard *sh = sc->sh;
+    int victim = -1;
+    long best = 0;
+
+    for (int tid = 0; tid < num_threads; tid++) {
+        if (finish[tid])
+            continue;
+        long cost = victim_cost(sc, tid);
+        if (ctl->victim_policy == REMAN_VICTIM_MIN) {
+            int *trial_finish = sh->seq;
+            memcpy(trial_finish, finish, (size_t)num_threads * sizeof(int));
+            trial_finish[tid] = 1;
+            if (ctl->unit_rows) {
+                uint64_t *trial_bits = sh->prefix_bits;
+                memcpy(trial_bits, sh->work_bits, (size_t)nz_words * sizeof(uint64_t));
+                add_allocation_bits(sc, trial_bits, tid);
+                cost = reduce_bits(sc, trial_bits, trial_finish);
+            } else {
+                int *trial_work = sh->prefix_work;
+                memcpy(trial_work + sc->c0, work + sc->c0, (size_t)(sc->c1 - sc->c0) * sizeof(int));
+                add_allocation(sc, trial_work, tid);
+                cost = reduce(sc, trial_work, trial_finish);
             }
         }
+        if (victim_better(tid, cost, victim, best)) {
+            victim = tid;
+            best = cost;
+        }
+    }
+    return victim;
+}
+
+// Deadlock detection and recovery pass over the scope's columns. Must be
+// called with the scope locked. Victims are preempted one after another,
+// continuing the same reduction, until no thread is left deadlocked.
+static int detect_locked(struct scope *sc) {
+    struct shard *sh = sc->sh;
+    int *work = sh->work_row;
+    int *finish = sh->finish;
+    int unit = ctl->unit_rows; // Work is sh->work_bits instead
+
+    // Initialize work array with available resources
+    if (unit) {
+        work_bits_init(sc, sh->work_bits, NULL);
     } else {
+        for (int i = sc->c0; i < sc->c1; i++) {
+            work[i] = available[i];
+        }
+    }
+    for (int tid = 0; tid < num_threads; tid++) {
+        finish[tid] = 0;
+    }
+
+
+    // Mark threads with no allocated resources as "finished"
+    for (int tid = 0; tid < num_threads; tid++) {
+        if (nz_empty(sc, ROW_NZ(alloc_nz, tid))) {
+            finish[tid] = 1;
+        }
+    }
+
+    // Try to finish threads in a simulated environment
+    int deadlock_count = unit ? reduce_bits(sc, sh->work_bits, finish) : reduce(sc, work, finish);
+
+    if (deadlock_count > 0) {
+        TRACE(TRACE_MANAGER, REMAN_TRACE_DETECT, -1, NULL, deadlock_count);
+
+        int left = deadlock_count;
+        while (left > 0) {
+            int victim = pick_victim(sc, work, finish);
+            finish[victim] = 1;
+            if (unit) {
+                add_allocation_bits(sc, sh->work_bits, victim);
+                preempt(sc, TRACE_MANAGER, victim);
+                left = reduce_bits(sc, sh->work_bits, finish);
+            } else {
+                add_allocation(sc, work, victim);
+                preempt(sc, TRACE_MANAGER, victim);
+                left = reduce(sc, work, finish);
+            }
+        }
+        wake_waiters(sc); // Preempted resources may unblock other threads
     }
 
-    pthread_mutex_unlock(&lock);
     return deadlock_count;
 }
 
+// Run detection shard by shard when no claim spans shards (then no cycle
+// can either), and over everything at once otherwise. The choice is made
+// with each shard locked: a claim or request spanning shards that arrives
+// midway sends the remaining shards to the global pass, so a per-shard pass
+// never preempts a cross-shard waiter it holds only part of the locks for.
+static int detect_pass() {
+    struct scope sc;
+    int deadlock_count = 0;
+    int s = 0;
+
+    robust_lock(&ctl->detect_lock, NULL);
+    uint64_t t0 = stats_enabled ? stats_now() : 0;
+    if (shared_role != SHARED_NONE) {
+        // Crashed processes keep what they held until reaped
+        scope_global(&sc);
+        scope_lock(&sc);
+        reap_locked(&sc);
+        scope_unlock(&sc);
+    }
+    for (; s < num_shards; s++) {
+        scope_single(&sc, s);
+        scope_lock(&sc);
+        if (ctl->cross_claims > 0 || ctl->ncross > 0) {
+            scope_unlock(&sc);
+            break;
+        }
+        deadlock_count += detect_locked(&sc);
+        scope_unlock(&sc);
+    }
+    if (s < num_shards) {
+        scope_global(&sc);
+        scope_lock(&sc);
+        deadlock_count += detect_locked(&sc);
+        scope_unlock(&sc);
+    }
+    if (t0 != 0) {
+        struct stats_slot *slot = &stats_slots[STATS_MANAGER];
+        STAT_ADD(slot, detections, 1);
+        STAT_ADD(slot, detect_ns, stats_now() - t0);
+    }
+    pthread_mutex_unlock(&ctl->detect_lock);
+    return deadlock_count;
+}
+
+int reman_detect() {
+    if (ctl == NULL)
+        return -1; // detect_lock lives in the arena
+    return detect_pass();
+}
+
+
+
+// Consistent copies of the state for observers. Each shard's version is
+// odd while its lock is held, and the fast-path counters show whether any
+// lock-free operation overlapped the copy, so a copy taken between two
+// equal even versions and unchanged counters is consistent without taking a
+// lock. Writers are never held up; a reader that keeps losing the race
+// copies under the lock after VIEW_RETRIES attempts.
+#define VIEW_RETRIES 64
+
+// Binary snapshot: a header, then capacity[] and available[], then the
+// allocated, requested and max_claim matrices, num_resources ints per row
+#define SNAPSHOT_MAGIC 0x52454d414e534e31ULL // Format version 1
+struct snapshot_header {
+    uint64_t magic;
+    int32_t t_count, r_count;
+};
+
+static size_t snapshot_size() {
+    return sizeof(struct snapshot_header) +
+           (2 + 3 * (size_t)num_threads) * (size_t)num_resources * sizeof(int);
+}
+
+// Copy the arrays into out in the snapshot layout, whatever the writers do
+static void copy_arrays(int out[]) {
+    size_t r = (size_t)num_resources, row = r * sizeof(int);
+    memcpy(out, capacity, row);
+    memcpy(out + r, available, row);
+    out += 2 * r;
+    int *matrices[] = {allocated, requested, max_claim};
+    for (int m = 0; m < 3; m++) {
+        for (int t = 0; t < num_threads; t++) {
+            memcpy(out, ROW(matrices[m], t), row);
+            out += r;
+        }
+    }
+}
+
+// Record every shard's version and fast-path count in seen[]; 0 if some
+// shard is being changed right now
+static int view_begin(unsigned seen[]) {
+    for (int s = 0; s < num_shards; s++) {
+        struct shard_state *st = shards[s].st;
+        unsigned version = __atomic_load_n(&st->version, __ATOMIC_ACQUIRE);
+        unsigned done = __atomic_load_n(&st->fast_done, __ATOMIC_ACQUIRE);
+        unsigned started = __atomic_load_n(&st->fast_started, __ATOMIC_ACQUIRE);
+        if (version & 1 || started != done)
+            return 0;
+        seen[2 * s] = version;
+        seen[2 * s + 1] = started;
+    }
+    return 1;
+}
+
+// Whether nothing changed since view_begin
+static int view_end(const unsigned seen[]) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    for (int s = 0; s < num_shards; s++) {
+        struct shard_state *st = shards[s].st;
+        if (__atomic_load_n(&st->version, __ATOMIC_RELAXED) != seen[2 * s] ||
+            __atomic_load_n(&st->fast_started, __ATOMIC_RELAXED) != seen[2 * s + 1])
+            return 0;
+    }
+    return 1;
+}
+
+// Consistent copy of the state in the snapshot layout
+static void copy_state(int out[]) {
+    unsigned *seen = malloc(2 * (size_t)num_shards * sizeof(unsigned));
+    for (int attempt = 0; seen != NULL && attempt < VIEW_RETRIES; attempt++) {
+        if (view_begin(seen)) {
+            copy_arrays(out);
+            if (view_end(seen)) {
+                free(seen);
+                return;
+            }
+        }
+        sched_yield();
+    }
+    free(seen);
 
+    struct scope sc;
+    scope_global(&sc);
+    scope_lock(&sc);
+    copy_arrays(out);
+    scope_unlock(&sc);
+}
 
 void reman_print(char title[]) {
-    pthread_mutex_lock(&lock);
+    size_t r = (size_t)num_resources;
+    int *view = malloc(snapshot_size() - sizeof(struct snapshot_header));
+    if (view == NULL)
+        return;
+    copy_state(view); // Formatted with no lock held
+    const int *avail = view + r;
+    const int *alloc = view + 2 * r;
+    const int *claim = alloc + 2 * (size_t)num_threads * r;
+
     printf("##########################\n");
     printf("%s\n", title);
     printf("##########################\n");
@@ -330,7 +2856,7 @@ void reman_print(char title[]) {
 
     printf("\nAvailable Resources:\n");
     for (int i = 0; i < num_resources; i++) {
-        printf("R%d: %d ", i, available[i]);
+        printf("R%d: %d ", i, avail[i]);
     }
     printf("\n");
 
@@ -338,7 +2864,7 @@ void reman_print(char title[]) {
     for (int tid = 0; tid < num_threads; tid++) {
         printf("T%d: ", tid);
         for (int i = 0; i < num_resources; i++) {
-            printf("%d ", max_claim[tid][i]);
+            printf("%d ", claim[tid * r + i]);
         }
         printf("\n");
     }
@@ -347,10 +2873,124 @@ void reman_print(char title[]) {
     for (int tid = 0; tid < num_threads; tid++) {
         printf("T%d: ", tid);
         for (int i = 0; i < num_resources; i++) {
-            printf("%d ", allocated[tid][i]);
+            printf("%d ", alloc[tid * r + i]);
         }
         printf("\n");
     }
 
-    pthread_mutex_unlock(&lock);
+    free(view);
+}
+
+int reman_snapshot(const char *path) {
+    size_t size = snapshot_size();
+    char *buf = malloc(size);
+    if (buf == NULL)
+        return -1;
+    struct snapshot_header *hdr = (struct snapshot_header *)buf;
+    hdr->magic = SNAPSHOT_MAGIC;
+    hdr->t_count = num_threads;
+    hdr->r_count = num_resources;
+    copy_state((int *)(hdr + 1)); // Written with no lock held
+
+    FILE *f = fopen(path, "wb");
+    int ok = f != NULL && fwrite(buf, 1, size, f) == size;
+    if (f != NULL && fclose(f) != 0)
+        ok = 0;
+    free(buf);
+    return ok ? 0 : -1;
+}
+
+// Whether the arrays of a snapshot describe a possible state: every unit
+// is either available or allocated, and no allocation plus pending request
+// exceeds its claim, the bound record_request puts on every live request
+static int snapshot_valid(const int in[]) {
+    size_t r = (size_t)num_resources;
+    const int *cap = in, *avail = in + r;
+    const int *alloc = in + 2 * r, *req = alloc + num_threads * r, *claim = req + num_threads * r;
+    for (size_t i = 0; i < r; i++) {
+        long units = avail[i];
+        if (cap[i] < 0 || avail[i] < 0)
+            return 0;
+        for (size_t t = 0; t < (size_t)num_threads; t++) {
+            int a = alloc[t * r + i], q = req[t * r + i];
+            if (a < 0 || q < 0 || (long)a + q > claim[t * r + i] || claim[t * r + i] > cap[i])
+                return 0;
+            units += a;
+        }
+        if (units != cap[i])
+            return 0;
+    }
+    return 1;
+}
+
+int reman_restore(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    size_t r = (size_t)num_resources, row = r * sizeof(int);
+    size_t size = snapshot_size();
+    struct stat sb;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &sb) == 0 && (size_t)sb.st_size == size)
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    const struct snapshot_header *hdr = map;
+    const int *in = (const int *)(hdr + 1);
+    if (hdr->magic != SNAPSHOT_MAGIC || hdr->t_count != num_threads ||
+        hdr->r_count != num_resources || !snapshot_valid(in)) {
+        munmap(map, size);
+        return -1; // Other geometry, or not a snapshot
+    }
+
+    struct scope sc;
+    scope_global(&sc);
+    scope_lock(&sc);
+    for (int t = 0; t < num_threads; t++) {
+        if (waiting[t]) {
+            scope_unlock(&sc);
+            munmap(map, size);
+            return -1; // Blocked threads would lose their request
+        }
+    }
+    memcpy(capacity, in, row);
+    memcpy(available, in + r, row);
+    in += 2 * r;
+    int *matrices[] = {allocated, requested, max_claim};
+    for (int m = 0; m < 3; m++) {
+        for (int t = 0; t < num_threads; t++) {
+            memcpy(ROW(matrices[m], t), in, row);
+            in += r;
+        }
+    }
+    munmap(map, size);
+
+    // Rebuild everything derived from the matrices
+    int single = 1;
+    for (int i = 0; i < num_resources; i++) {
+        single &= capacity[i] == 1;
+        holder[i] = -1;
+    }
+    ctl->wfg_active = detection_mode() && single;
+    ctl->unit_rows = single;
+    for (int t = 0; t < num_threads; t++) {
+        nz_rebuild(&sc, ROW(allocated, t), ROW_NZ(alloc_nz, t));
+        nz_rebuild(&sc, ROW(requested, t), ROW_NZ(req_nz, t));
+        nz_rebuild(&sc, ROW(max_claim, t), ROW_NZ(claim_nz, t));
+        track_claim(&sc, t);
+        if (ctl->wfg_active) {
+            int i;
+            FOR_EACH_NZ(&sc, ROW_NZ(alloc_nz, t), i) {
+                holder[i] = t;
+            }
+        }
+    }
+    for (int s = 0; s < num_shards; s++) {
+        shards[s].st->safe_seq_valid = 0;
+    }
+    global_shard->st->safe_seq_valid = 0;
+    scope_unlock(&sc);
+    return 0;
 }
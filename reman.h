@@ -1,14 +1,167 @@
 #ifndef REMAN_H
 #define REMAN_H
-#define MAXR 1000 // max num of resource types supported
+#include <stdint.h>
 
-#define MAXT 100 // max num of threads supported
+// Thread and resource counts are limited only by memory: reman_init sizes
+// all state exactly for t_count x r_count. avoid picks how deadlock is
+// handled:
+#define REMAN_DETECT 0  // grant what fits; reman_detect finds deadlocks and preempts
+#define REMAN_AVOID 1   // grant only what keeps the state safe (banker's algorithm)
+#define REMAN_ORDERED 2 // prevent them: a thread may only request resources with
+                        // higher indices than any it holds, others are denied.
+                        // No safety check or detection, O(r_count) per request.
 int reman_init(int t_count, int r_count, int avoid);
+int reman_set_capacity(int count[]); // instances per resource type, default 1 each; after reman_init
+// Stop the detector thread, dump unread trace records and free all manager
+// state; in shared mode the creator also removes the segment, other
+// processes only unmap it. Call once no thread is inside another reman_
+// call; reman_init or reman_attach may then set up a new manager. Returns -1
+// when there is no manager.
+int reman_destroy();
+
+// Call before reman_init to split the resources into count groups of
+// consecutive indices, sizes[g] each, summing to r_count. Each group has its
+// own lock, so threads working in different groups do not contend.
+// Operations that span groups lock all of them.
+int reman_set_groups(int count, int sizes[]);
+
+// Safety check and detection kernels compiled for one fixed geometry, from
+// reman_fixed.h. Call reman_set_fixed before reman_init (or reman_attach);
+// the kernels are used for scans over all resources whenever t_count and
+// r_count match and some capacity is above 1, and ignored otherwise.
+// Matrices are passed as t_count rows of stride ints, each row padded to a
+// multiple of REMAN_ROW_ALIGN like the manager's own.
+#define REMAN_ROW_ALIGN 16 // one cache line, two AVX2 vectors
+#define REMAN_FIXED_STRIDE(r) (((r) + REMAN_ROW_ALIGN - 1) / REMAN_ROW_ALIGN * REMAN_ROW_ALIGN)
+struct reman_fixed {
+    int t_count, r_count, stride;
+    int (*safe)(const int available[], const int allocated[], const int max_claim[],
+                const int delta[], int tid, int seq[]);
+    int (*reduce)(int work[], const int allocated[], const int requested[], int finish[]);
+};
+int reman_set_fixed(const struct reman_fixed *kernels); // NULL for none (default)
+
+// Shared-memory mode for cooperating processes. Call reman_set_shared
+// before reman_init to place all manager state in a new POSIX shared memory
+// segment (shm_open name, e.g. "/reman"). Other processes call reman_attach
+// instead of reman_init and then connect their threads with tids of their
+// own. What the threads of a crashed process held is reclaimed. reman_destroy
+// removes the segment in the creating process and only unmaps it elsewhere.
+int reman_set_shared(const char *name); // NULL for private mode (default)
+int reman_attach(const char *name);
 int reman_connect(int tid);
 int reman_disconnect();
 int reman_claim(int claim[]); // only for avoidance
-int reman_request(int request[]);
+int reman_request(int request[]); // REMAN_PREEMPTED if deadlock recovery took it back
+// Variants with a deadline. A request that cannot be granted in time is
+// withdrawn and fails with REMAN_TIMEDOUT; reman_tryrequest never blocks.
+#define REMAN_TIMEDOUT -3
+int reman_tryrequest(int request[]);
+int reman_request_timed(int request[], int timeout_ms);
 int reman_release(int release[]);
+
+// One step of a reman_batch transaction
+#define REMAN_OP_REQUEST 1
+#define REMAN_OP_RELEASE 2
+struct reman_op {
+    int type;    // REMAN_OP_REQUEST or REMAN_OP_RELEASE
+    int *vector; // num_resources counts
+};
+// Apply ops in order for the calling thread under one lock acquisition and
+// one safety evaluation of the net effect; blocks like reman_request
+int reman_batch(struct reman_op ops[], int count);
+
 int reman_detect();
+// Call before reman_init to run detection passes on a thread of their own,
+// every msec and whenever a request blocks. With 0, the default, a request
+// that blocks in detection mode runs the pass itself.
+int reman_set_detect_period(int msec);
+
+// Observers: reman_print and reman_snapshot copy a consistent view of the
+// state without taking a lock (falling back to one if writers keep changing
+// it) and format or write it with no lock held.
 void reman_print(char titlemsg[]);
+
+// Binary snapshot of capacity, available, allocated, requested and
+// max_claim. reman_restore maps a snapshot taken with the
+// same thread and resource counts and loads it while no thread is blocked;
+// requests pending in it come back pending, for reman_detect to examine.
+int reman_snapshot(const char *path);
+int reman_restore(const char *path);
+
+// Deadlock recovery preempts everything its victims hold and fails their
+// blocked request or batch with REMAN_PREEMPTED. Ties between candidates go
+// to the thread preempted least often so far.
+#define REMAN_PREEMPTED -2
+#define REMAN_VICTIM_FIRST 0    // lowest tid (default)
+#define REMAN_VICTIM_FEWEST 1   // fewest instances held
+#define REMAN_VICTIM_PRIORITY 2 // lowest reman_set_priority value
+#define REMAN_VICTIM_YOUNGEST 3 // most recently connected
+#define REMAN_VICTIM_MIN 4      // fewest preemptions to clear the deadlock (greedy)
+int reman_set_victim_policy(int policy);
+int reman_set_priority(int prio); // for the calling thread, default 0
+
+// Order in which blocked requests are granted as resources free up. Every
+// policy ages waiters, and a waiter passed over for long enough reserves
+// its group: nothing else there is granted until it is.
+#define REMAN_GRANT_FIFO 0     // arrival order (default)
+#define REMAN_GRANT_PRIORITY 1 // highest reman_set_priority value first
+#define REMAN_GRANT_SHORTEST 2 // fewest instances requested first
+int reman_set_grant_policy(int policy);
+
+// Call before reman_init to route requests and releases that need the lock
+// through flat combining: each thread publishes its operation and one of
+// them applies all published ones under a single lock acquisition.
+// Requests that would block still wait as usual. Ignored in shared mode.
+int reman_set_combining(int enable);
+
+// Built-in metrics, merged from per-thread counters on read. Enable with
+// reman_set_stats(1) before reman_init; operations of threads that are not
+// connected are not counted.
+#define REMAN_STATS_BUCKETS 32 // bucket b: waits of [2^b, 2^(b+1)) ns, last one open
+struct reman_stats {
+    uint64_t requests;      // reman_request and reman_batch calls
+    uint64_t grants;
+    uint64_t denies;        // over the claim, or out of order in REMAN_ORDERED mode
+    uint64_t blocks;        // requests that had to wait
+    uint64_t preemptions;   // requests failed with REMAN_PREEMPTED
+    uint64_t timeouts;      // requests failed with REMAN_TIMEDOUT
+    uint64_t releases;
+    uint64_t fast_path;     // requests and releases that never took a lock
+    uint64_t combined;      // requests and releases applied in a combining pass
+    uint64_t lock_acquires;
+    uint64_t lock_wait_ns;
+    uint64_t lock_hold_ns;
+    uint64_t safety_checks; // avoidance mode
+    uint64_t safety_ns;
+    uint64_t detections;    // detection passes
+    uint64_t detect_ns;
+};
+int reman_set_stats(int enable);
+int reman_stats(struct reman_stats *out);
+int reman_stats_wait_hist(int resource, uint64_t hist[REMAN_STATS_BUCKETS]);
+
+// Binary trace of manager operations, kept in per-thread lock-free rings
+#define REMAN_TRACE_CONNECT 1
+#define REMAN_TRACE_DISCONNECT 2
+#define REMAN_TRACE_CLAIM 3
+#define REMAN_TRACE_REQUEST 4  // result 0 granted, -1 denied, -2 preempted, -3 timed out
+#define REMAN_TRACE_BLOCK 5    // request queued behind a shortfall or unsafe state
+#define REMAN_TRACE_GRANT 6    // blocked request granted
+#define REMAN_TRACE_RELEASE 7
+#define REMAN_TRACE_BATCH 8
+#define REMAN_TRACE_DETECT 9   // tid -1, result = deadlocked thread count
+#define REMAN_TRACE_PREEMPT 10 // tid = victim, digest of the preempted allocation
+struct reman_trace_rec {
+    uint64_t ts_ns;  // CLOCK_MONOTONIC
+    int op;          // REMAN_TRACE_*
+    int tid;
+    int result;
+    uint32_t digest; // hash of the vector involved, 0 if none
+};
+// Call before reman_init. capacity records per thread (rounded up to a power
+// of two), 0 disables tracing. Records still unread at reman_destroy are
+// written as text to dump_path when it is not NULL.
+int reman_set_trace(int capacity, const char *dump_path);
+int reman_trace_read(struct reman_trace_rec out[], int max);
 #endif /* REMAN_H */
\ No newline at end of file
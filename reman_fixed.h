@@ -0,0 +1,126 @@
+// Safety check and detection kernels specialized for one fixed geometry.
+// Instantiate them in one source file by defining the geometry and a name
+// and including this header, once per geometry:
+//
+//     #define REMAN_FIXED_T 16
+//     #define REMAN_FIXED_R 32
+//     #define REMAN_FIXED_NAME fixed_16x32
+//     #include "reman_fixed.h"
+//
+// This defines a static struct reman_fixed fixed_16x32 to hand to
+// reman_set_fixed before reman_init. With the thread and resource counts
+// known at compile time every loop has constant bounds, so the compiler can
+// unroll them, keep work[] in registers and vectorize the row compares.
+// The runtime-sized code still serves any other geometry, scans that cover
+// only some resource groups, and single-instance resources, where its
+// bitmap scans are faster.
+#include "reman.h"
+
+#if !defined(REMAN_FIXED_T) || !defined(REMAN_FIXED_R) || !defined(REMAN_FIXED_NAME)
+#error "define REMAN_FIXED_T, REMAN_FIXED_R and REMAN_FIXED_NAME before including reman_fixed.h"
+#endif
+
+// Matrix rows are padded like the manager's own, to whole cache lines
+#define REMAN_FIXED_S REMAN_FIXED_STRIDE(REMAN_FIXED_R)
+#define REMAN_FIXED_CAT_(a, b) a##_##b
+#define REMAN_FIXED_CAT(a, b) REMAN_FIXED_CAT_(a, b)
+#define REMAN_FIXED_FN(f) REMAN_FIXED_CAT(REMAN_FIXED_NAME, f)
+
+// Banker's safety check of the state in which tid additionally holds
+// delta[]. Threads found to finish are written to seq[]; returns how many.
+static int REMAN_FIXED_FN(safe)(const int available[], const int allocated[],
+                                const int max_claim[], const int delta[], int tid,
+                                int seq[]) {
+    const int(*alloc)[REMAN_FIXED_S] = (const int(*)[REMAN_FIXED_S])allocated;
+    const int(*claim)[REMAN_FIXED_S] = (const int(*)[REMAN_FIXED_S])max_claim;
+    static const int none[REMAN_FIXED_R];
+    int work[REMAN_FIXED_R];
+    char finish[REMAN_FIXED_T] = {0};
+    int count = 0;
+
+    for (int i = 0; i < REMAN_FIXED_R; i++) {
+        work[i] = available[i] - delta[i];
+    }
+    int found;
+    do {
+        found = 0;
+        for (int t = 0; t < REMAN_FIXED_T; t++) {
+            if (finish[t])
+                continue;
+            // No early exit, so the compare vectorizes
+            const int *held = t == tid ? delta : none;
+            int short_of = 0;
+            for (int i = 0; i < REMAN_FIXED_R; i++) {
+                short_of |= claim[t][i] - alloc[t][i] - held[i] > work[i];
+            }
+            if (short_of)
+                continue;
+            for (int i = 0; i < REMAN_FIXED_R; i++) {
+                work[i] += alloc[t][i] + held[i];
+            }
+            finish[t] = 1;
+            seq[count++] = t;
+            found = 1;
+        }
+    } while (found);
+    return count;
+}
+
+// Detection reduction: finish every thread whose pending request fits in
+// work[], returning its allocation to work[], until no more can. Returns
+// how many are left.
+static int REMAN_FIXED_FN(reduce)(int work[], const int allocated[], const int requested[],
+                                  int finish[]) {
+    const int(*alloc)[REMAN_FIXED_S] = (const int(*)[REMAN_FIXED_S])allocated;
+    const int(*req)[REMAN_FIXED_S] = (const int(*)[REMAN_FIXED_S])requested;
+    int w[REMAN_FIXED_R];
+    int left = 0;
+
+    for (int i = 0; i < REMAN_FIXED_R; i++) {
+        w[i] = work[i];
+    }
+    int found;
+    do {
+        found = 0;
+        for (int t = 0; t < REMAN_FIXED_T; t++) {
+            if (finish[t])
+                continue;
+            int short_of = 0;
+            for (int i = 0; i < REMAN_FIXED_R; i++) {
+                short_of |= req[t][i] > w[i];
+            }
+            if (short_of)
+                continue;
+            for (int i = 0; i < REMAN_FIXED_R; i++) {
+                w[i] += alloc[t][i];
+            }
+            finish[t] = 1;
+            found = 1;
+        }
+    } while (found);
+
+    for (int i = 0; i < REMAN_FIXED_R; i++) {
+        work[i] = w[i];
+    }
+    for (int t = 0; t < REMAN_FIXED_T; t++) {
+        left += !finish[t];
+    }
+    return left;
+}
+
+static const struct reman_fixed REMAN_FIXED_NAME = {
+    REMAN_FIXED_T,
+    REMAN_FIXED_R,
+    REMAN_FIXED_S,
+    REMAN_FIXED_FN(safe),
+    REMAN_FIXED_FN(reduce),
+};
+
+// Ready for the next instantiation
+#undef REMAN_FIXED_S
+#undef REMAN_FIXED_CAT_
+#undef REMAN_FIXED_CAT
+#undef REMAN_FIXED_FN
+#undef REMAN_FIXED_T
+#undef REMAN_FIXED_R
+#undef REMAN_FIXED_NAME
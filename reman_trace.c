@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "reman_trace.h"
+
+#define CACHE_LINE 64
+
+// Producer and consumer indexes sit on separate cache lines
+struct trace_ring {
+    uint64_t head __attribute__((aligned(CACHE_LINE))); // next slot to write
+    long dropped;
+    uint64_t tail __attribute__((aligned(CACHE_LINE))); // next slot to read
+    struct reman_trace_rec *recs;
+};
+
+static struct trace_ring *rings;
+static struct reman_trace_rec *trace_slots;
+static int trace_nrings;
+static uint64_t trace_mask;                 // capacity - 1, capacity is a power of two
+static pthread_mutex_t trace_read_lock = PTHREAD_MUTEX_INITIALIZER; // serializes readers
+
+static const char *trace_op_names[] = {
+    "?", "connect", "disconnect", "claim", "request", "block", "grant",
+    "release", "batch", "detect", "preempt",
+};
+
+int reman_trace_init(int nrings, int capacity) {
+    uint64_t cap = 1;
+    while (cap < (uint64_t)capacity) {
+        cap <<= 1;
+    }
+
+    if (posix_memalign((void **)&rings, CACHE_LINE, (size_t)nrings * sizeof(struct trace_ring)) != 0)
+        return -1;
+    trace_slots = malloc((size_t)nrings * cap * sizeof(struct reman_trace_rec));
+    if (trace_slots == NULL) {
+        free(rings);
+        rings = NULL;
+        return -1;
+    }
+    memset(rings, 0, (size_t)nrings * sizeof(struct trace_ring));
+    for (int r = 0; r < nrings; r++) {
+        rings[r].recs = trace_slots + (size_t)r * cap;
+    }
+    trace_mask = cap - 1;
+    trace_nrings = nrings;
+    return 0;
+}
+
+void reman_trace_free() {
+    free(trace_slots);
+    free(rings);
+    trace_slots = NULL;
+    rings = NULL;
+    trace_nrings = 0;
+}
+
+// FNV-1a over the vector, enough to tell request vectors apart in a trace
+static uint32_t trace_digest(const int vector[], int n) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < n; i++) {
+        h = (h ^ (uint32_t)vector[i]) * 16777619u;
+    }
+    return h;
+}
+
+void reman_trace_emit(int ring, int op, int tid, const int vector[], int n, int result) {
+    struct trace_ring *tr = &rings[ring];
+    uint64_t head = tr->head;
+    if (head - __atomic_load_n(&tr->tail, __ATOMIC_ACQUIRE) > trace_mask) {
+        __atomic_store_n(&tr->dropped, tr->dropped + 1, __ATOMIC_RELAXED);
+        return; // Full; never wait on the reader
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    struct reman_trace_rec *rec = &tr->recs[head & trace_mask];
+    rec->ts_ns = (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+    rec->op = op;
+    rec->tid = tid;
+    rec->result = result;
+    rec->digest = vector != NULL ? trace_digest(vector, n) : 0;
+    __atomic_store_n(&tr->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Drain up to max records, ring by ring. Records within a ring are in order;
+// merge on ts_ns for a global order.
+int reman_trace_drain(struct reman_trace_rec out[], int max) {
+    int count = 0;
+
+    pthread_mutex_lock(&trace_read_lock);
+    for (int r = 0; r < trace_nrings && count < max; r++) {
+        struct trace_ring *tr = &rings[r];
+        uint64_t tail = tr->tail;
+        uint64_t head = __atomic_load_n(&tr->head, __ATOMIC_ACQUIRE);
+        while (tail != head && count < max) {
+            out[count++] = tr->recs[tail & trace_mask];
+            tail++;
+        }
+        __atomic_store_n(&tr->tail, tail, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&trace_read_lock);
+    return count;
+}
+
+static long trace_dropped() {
+    long dropped = 0;
+    for (int r = 0; r < trace_nrings; r++) {
+        dropped += __atomic_load_n(&rings[r].dropped, __ATOMIC_RELAXED);
+    }
+    return dropped;
+}
+
+void reman_trace_dump(FILE *out) {
+    struct reman_trace_rec buf[256];
+    int n;
+
+    while ((n = reman_trace_drain(buf, 256)) > 0) {
+        for (int k = 0; k < n; k++) {
+            int op = buf[k].op;
+            if (op < 0 || op >= (int)(sizeof(trace_op_names) / sizeof(trace_op_names[0])))
+                op = 0;
+            fprintf(out, "%llu T%d %s %08x %d\n", (unsigned long long)buf[k].ts_ns,
+                    buf[k].tid, trace_op_names[op], buf[k].digest, buf[k].result);
+        }
+    }
+    if (trace_dropped() > 0) {
+        fprintf(out, "dropped %ld\n", trace_dropped());
+    }
+}
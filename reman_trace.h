@@ -0,0 +1,16 @@
+#ifndef REMAN_TRACE_H
+#define REMAN_TRACE_H
+#include <stdio.h>
+#include "reman.h"
+
+// Binary trace rings. Every ring has a single producer: ring t is written
+// only by the thread connected as tid t, and the last ring (TRACE_MANAGER)
+// only under the manager lock. Producers never block; a full ring drops the
+// record and counts it.
+int reman_trace_init(int nrings, int capacity);
+void reman_trace_free();
+void reman_trace_emit(int ring, int op, int tid, const int vector[], int n, int result);
+int reman_trace_drain(struct reman_trace_rec out[], int max);
+void reman_trace_dump(FILE *out);
+
+#endif /* REMAN_TRACE_H */
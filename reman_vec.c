@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "reman_vec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VEC_X86 1
+#endif
+
+// Scalar versions, also used for the tails of the vector versions
+
+static int le_scalar(const int a[], const int b[], int n) {
+    for (int i = 0; i < n; i++) {
+        if (a[i] > b[i])
+            return 0;
+    }
+    return 1;
+}
+
+static int sum_le_scalar(const int a[], const int b[], const int c[], int n) {
+    for (int i = 0; i < n; i++) {
+        if (a[i] + b[i] > c[i])
+            return 0;
+    }
+    return 1;
+}
+
+static int diff_le_scalar(const int a[], const int b[], const int c[], int n) {
+    for (int i = 0; i < n; i++) {
+        if (a[i] - b[i] > c[i])
+            return 0;
+    }
+    return 1;
+}
+
+static void add_scalar(int a[], const int b[], int n) {
+    for (int i = 0; i < n; i++) {
+        a[i] += b[i];
+    }
+}
+
+static void sub_scalar(int a[], const int b[], int n) {
+    for (int i = 0; i < n; i++) {
+        a[i] -= b[i];
+    }
+}
+
+static void nz_mask_scalar(const int a[], int n, uint64_t mask[]) {
+    memset(mask, 0, (size_t)(n + 63) / 64 * sizeof(uint64_t));
+    for (int i = 0; i < n; i++) {
+        if (a[i] != 0)
+            mask[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+}
+
+#ifdef VEC_X86
+
+// SSE2: 4 ints per step
+
+__attribute__((target("sse2")))
+static int le_sse2(const int a[], const int b[], int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        if (_mm_movemask_epi8(_mm_cmpgt_epi32(va, vb)))
+            return 0;
+    }
+    return le_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static int sum_le_sse2(const int a[], const int b[], const int c[], int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i vc = _mm_loadu_si128((const __m128i *)(c + i));
+        if (_mm_movemask_epi8(_mm_cmpgt_epi32(_mm_add_epi32(va, vb), vc)))
+            return 0;
+    }
+    return sum_le_scalar(a + i, b + i, c + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static int diff_le_sse2(const int a[], const int b[], const int c[], int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i vc = _mm_loadu_si128((const __m128i *)(c + i));
+        if (_mm_movemask_epi8(_mm_cmpgt_epi32(_mm_sub_epi32(va, vb), vc)))
+            return 0;
+    }
+    return diff_le_scalar(a + i, b + i, c + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void add_sse2(int a[], const int b[], int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(a + i), _mm_add_epi32(va, vb));
+    }
+    add_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void sub_sse2(int a[], const int b[], int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(a + i), _mm_sub_epi32(va, vb));
+    }
+    sub_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void nz_mask_sse2(const int a[], int n, uint64_t mask[]) {
+    memset(mask, 0, (size_t)(n + 63) / 64 * sizeof(uint64_t));
+    __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        int zero_bits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, zero)));
+        mask[i / 64] |= (uint64_t)(~zero_bits & 0xf) << (i % 64);
+    }
+    for (; i < n; i++) {
+        if (a[i] != 0)
+            mask[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+}
+
+// AVX2: 8 ints per step
+
+__attribute__((target("avx2")))
+static int le_avx2(const int a[], const int b[], int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i gt = _mm256_cmpgt_epi32(va, vb);
+        if (!_mm256_testz_si256(gt, gt))
+            return 0;
+    }
+    return le_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int sum_le_avx2(const int a[], const int b[], const int c[], int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i vc = _mm256_loadu_si256((const __m256i *)(c + i));
+        __m256i gt = _mm256_cmpgt_epi32(_mm256_add_epi32(va, vb), vc);
+        if (!_mm256_testz_si256(gt, gt))
+            return 0;
+    }
+    return sum_le_scalar(a + i, b + i, c + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int diff_le_avx2(const int a[], const int b[], const int c[], int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i vc = _mm256_loadu_si256((const __m256i *)(c + i));
+        __m256i gt = _mm256_cmpgt_epi32(_mm256_sub_epi32(va, vb), vc);
+        if (!_mm256_testz_si256(gt, gt))
+            return 0;
+    }
+    return diff_le_scalar(a + i, b + i, c + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void add_avx2(int a[], const int b[], int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        _mm256_storeu_si256((__m256i *)(a + i), _mm256_add_epi32(va, vb));
+    }
+    add_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void sub_avx2(int a[], const int b[], int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        _mm256_storeu_si256((__m256i *)(a + i), _mm256_sub_epi32(va, vb));
+    }
+    sub_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void nz_mask_avx2(const int a[], int n, uint64_t mask[]) {
+    memset(mask, 0, (size_t)(n + 63) / 64 * sizeof(uint64_t));
+    __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        int zero_bits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(va, zero)));
+        mask[i / 64] |= (uint64_t)(~zero_bits & 0xff) << (i % 64);
+    }
+    for (; i < n; i++) {
+        if (a[i] != 0)
+            mask[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+}
+
+#endif /* VEC_X86 */
+
+int (*reman_vec_le)(const int a[], const int b[], int n) = le_scalar;
+int (*reman_vec_sum_le)(const int a[], const int b[], const int c[], int n) = sum_le_scalar;
+int (*reman_vec_diff_le)(const int a[], const int b[], const int c[], int n) = diff_le_scalar;
+void (*reman_vec_add)(int a[], const int b[], int n) = add_scalar;
+void (*reman_vec_sub)(int a[], const int b[], int n) = sub_scalar;
+void (*reman_vec_nz_mask)(const int a[], int n, uint64_t mask[]) = nz_mask_scalar;
+static const char *vec_selected = "scalar";
+
+void reman_vec_init() {
+    const char *force = getenv("REMAN_ISA");
+
+    reman_vec_le = le_scalar;
+    reman_vec_sum_le = sum_le_scalar;
+    reman_vec_diff_le = diff_le_scalar;
+    reman_vec_add = add_scalar;
+    reman_vec_sub = sub_scalar;
+    reman_vec_nz_mask = nz_mask_scalar;
+    vec_selected = "scalar";
+
+#ifdef VEC_X86
+    __builtin_cpu_init();
+    int want_sse2 = force == NULL || strcmp(force, "sse2") == 0 || strcmp(force, "avx2") == 0;
+    int want_avx2 = force == NULL || strcmp(force, "avx2") == 0;
+
+    if (want_avx2 && __builtin_cpu_supports("avx2")) {
+        reman_vec_le = le_avx2;
+        reman_vec_sum_le = sum_le_avx2;
+        reman_vec_diff_le = diff_le_avx2;
+        reman_vec_add = add_avx2;
+        reman_vec_sub = sub_avx2;
+        reman_vec_nz_mask = nz_mask_avx2;
+        vec_selected = "avx2";
+    } else if (want_sse2 && __builtin_cpu_supports("sse2")) {
+        reman_vec_le = le_sse2;
+        reman_vec_sum_le = sum_le_sse2;
+        reman_vec_diff_le = diff_le_sse2;
+        reman_vec_add = add_sse2;
+        reman_vec_sub = sub_sse2;
+        reman_vec_nz_mask = nz_mask_sse2;
+        vec_selected = "sse2";
+    }
+#else
+    (void)force;
+#endif
+}
+
+const char *reman_vec_isa() {
+    return vec_selected;
+}
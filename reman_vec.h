@@ -0,0 +1,19 @@
+#ifndef REMAN_VEC_H
+#define REMAN_VEC_H
+#include <stdint.h>
+
+// Kernels over resource rows of n ints. reman_vec_init() picks the AVX2,
+// SSE2 or scalar version for the running CPU; REMAN_ISA=scalar|sse2|avx2 in
+// the environment forces one (down to what the CPU supports), and
+// reman_vec_isa() names the one in use.
+extern int (*reman_vec_le)(const int a[], const int b[], int n);                     // all a <= b
+extern int (*reman_vec_sum_le)(const int a[], const int b[], const int c[], int n);  // all a + b <= c
+extern int (*reman_vec_diff_le)(const int a[], const int b[], const int c[], int n); // all a - b <= c
+extern void (*reman_vec_add)(int a[], const int b[], int n);                         // a += b
+extern void (*reman_vec_sub)(int a[], const int b[], int n);                         // a -= b
+extern void (*reman_vec_nz_mask)(const int a[], int n, uint64_t mask[]);             // bit i = (a[i] != 0)
+
+void reman_vec_init();
+const char *reman_vec_isa();
+
+#endif /* REMAN_VEC_H */
@@ -43,9 +43,9 @@ void setarray(int r[], int m, ...)
 void *threadfunc1(void *a)
 {
     int tid;
-    int request1[MAXR];
-    int request2[MAXR];
-    int claim[MAXR];
+    int request1[NUMR];
+    int request2[NUMR];
+    int claim[NUMR];
 
     tid = *((int *)a);
     reman_connect(tid);
@@ -81,9 +81,9 @@ void *threadfunc1(void *a)
 void *threadfunc2(void *a)
 {
     int tid;
-    int request1[MAXR];
-    int request2[MAXR];
-    int claim[MAXR];
+    int request1[NUMR];
+    int request2[NUMR];
+    int claim[NUMR];
 
     tid = *((int *)a);
     reman_connect(tid);
@@ -119,9 +119,9 @@ void *threadfunc2(void *a)
 void *threadfunc3(void *a)
 {
     int tid;
-    int request1[MAXR];
-    int request2[MAXR];
-    int claim[MAXR];
+    int request1[NUMR];
+    int request2[NUMR];
+    int claim[NUMR];
 
     tid = *((int *)a);
     reman_connect(tid);
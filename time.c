@@ -49,9 +49,9 @@ void setarray(int r[], int m, ...)
 void *threadfunc1(void *a)
 {
     int tid;
-    int request1[MAXR];
-    int request2[MAXR];
-    int claim[MAXR];
+    int request1[NUMR];
+    int request2[NUMR];
+    int claim[NUMR];
     struct timespec start, end;
 
     tid = *((int *)a);
@@ -98,9 +98,9 @@ void *threadfunc1(void *a)
 void *threadfunc2(void *a)
 {
     int tid;
-    int request1[MAXR];
-    int request2[MAXR];
-    int claim[MAXR];
+    int request1[NUMR];
+    int request2[NUMR];
+    int claim[NUMR];
     struct timespec start, end;
 
     tid = *((int *)a);
@@ -147,9 +147,9 @@ void *threadfunc2(void *a)
 void *threadfunc3(void *a)
 {
     int tid;
-    int request1[MAXR];
-    int request2[MAXR];
-    int claim[MAXR];
+    int request1[NUMR];
+    int request2[NUMR];
+    int claim[NUMR];
     struct timespec start, end;
 
     tid = *((int *)a);
@@ -36,8 +36,8 @@ void setarray(int r[], int m, ...) {
 
 void *threadfunc1(void *a) {
     int tid;
-    int request1[MAXR];
-    int claim[MAXR];
+    int request1[NUMR];
+    int claim[NUMR];
 
     tid = *((int *)a);
     reman_connect(tid);
@@ -63,8 +63,8 @@ void *threadfunc1(void *a) {
 
 void *threadfunc2(void *a) {
     int tid;
-    int request1[MAXR];
-    int claim[MAXR];
+    int request1[NUMR];
+    int claim[NUMR];
 
     tid = *((int *)a);
     reman_connect(tid);
@@ -90,8 +90,8 @@ void *threadfunc2(void *a) {
 
 void *threadfunc3(void *a) {
     int tid;
-    int request1[MAXR];
-    int claim[MAXR];
+    int request1[NUMR];
+    int claim[NUMR];
 
     tid = *((int *)a);
     reman_connect(tid);